@@ -18,355 +18,4012 @@
 #include <linux/slab.h>    /* Needed for kmalloc, kzalloc etc. */
 #include <linux/errno.h>   /* Needed for error checking */
 #include <linux/mutex.h>	/* Sync primitives */
+#include <linux/rwsem.h>
+#include <linux/bitops.h>	/* stripe masks */
+#include <linux/seqlock.h>	/* lockless reads */
+#include <linux/rcupdate.h>
+#include <linux/uio.h>	/* iov_iter */
+#include <linux/sched/signal.h>	/* sliced transfers */
+#include <linux/file.h>	/* copies between devices */
 #include <linux/device.h>	/* device class */
+#include <linux/mm.h>	/* page allocation */
+#include <linux/xarray.h>	/* page-indexed ramdisk store */
+#include <linux/jump_label.h>	/* static keys for debug logging */
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>	/* statistics */
+#include <linux/ktime.h>
+#include <linux/sysfs.h>
+#include <linux/wait.h>	/* FIFO mode */
+#include <linux/poll.h>
+#include <linux/math64.h>
+#include <linux/eventfd.h>	/* ring mode doorbells */
+#include <linux/workqueue.h>	/* constant time clear */
+#include <linux/pseudo_fs.h>
+#include <linux/mount.h>
+#include <linux/miscdevice.h>	/* control device */
+#include <linux/capability.h>
+#include <linux/mman.h>	/* huge pages */
+#include <linux/pfn_t.h>
+#include <linux/huge_mm.h>
+#include <linux/highmem.h>	/* atomic word ops */
+#include <linux/crypto.h>	/* compression */
+#include <linux/shrinker.h>	/* ASP_MODE_CACHE */
+#include <linux/version.h>
 #include <asm/uaccess.h>	/* copy_*_user */
 
 #include "asp_mycdev.h"    /* Custom header for the drivers */
 
+#define CREATE_TRACE_POINTS
+#include "asp_mycdev_trace.h"	/* Tracepoints of the driver */
+
 /* Parameters that can be changed at load time */
 static int mycdev_major = DEFAULT_MAJOR;
 static int mycdev_minor = DEFAULT_MINOR;
 static int max_devices = DEFAULT_NUM_DEVICES;
 static long ramdisk_size_in_bytes = DEFAULT_RAMDISK_SIZE;
+static long max_size_in_bytes = 0;
+static int numa_policy = ASP_NUMA_LOCAL;
+static int numa_node = NUMA_NO_NODE;
 
 module_param(mycdev_major, int, S_IRUGO);
 module_param(mycdev_minor, int, S_IRUGO);
 module_param(max_devices,  int, S_IRUGO);
 module_param(ramdisk_size_in_bytes, long, S_IRUGO);
+/* growth cap of new devices, a page multiple, 0 for none; see ASP_SET_LIMIT */
+module_param(max_size_in_bytes, long, S_IRUGO);
+/* ASP_NUMA_* placement of the pages of new devices, numa_node for ASP_NUMA_FIXED */
+module_param(numa_policy, int, S_IRUGO);
+module_param(numa_node, int, S_IRUGO);
+/* ASP_MODE_COMPRESS: crypto API algorithm, and seconds a page has to stay idle */
+static char *compressor = "lz4";
+static int compress_interval = 30;
+module_param(compressor, charp, S_IRUGO);
+module_param(compress_interval, int, S_IRUGO);
+
+/* Debug logging, compiled in but patched out by a static key unless the
+debug parameter is set, at load time or through /sys/module/.../debug */
+static DEFINE_STATIC_KEY_FALSE(asp_mycdev_debug_key);
+
+static int asp_mycdev_set_debug(const char *val, const struct kernel_param *kp)
+{
+	bool enable = false;
+	int retval = kstrtobool(val, &enable);
+
+	if(retval)
+		return retval;
+	if(enable)
+		static_branch_enable(&asp_mycdev_debug_key);
+	else
+		static_branch_disable(&asp_mycdev_debug_key);
+	return 0;
+}
+
+static int asp_mycdev_get_debug(char *buf, const struct kernel_param *kp)
+{
+	return sprintf(buf, "%c\n", static_key_enabled(&asp_mycdev_debug_key)? 'Y' : 'N');
+}
+
+static const struct kernel_param_ops asp_mycdev_debug_ops = {
+	.set = asp_mycdev_set_debug,
+	.get = asp_mycdev_get_debug,
+};
+module_param_cb(debug, &asp_mycdev_debug_ops, NULL, S_IRUGO | S_IWUSR);
+
+#define asp_dbg(mycdev, fmt, ...)	\
+	do {	\
+		if(static_branch_unlikely(&asp_mycdev_debug_key))	\
+			printk(KERN_DEBUG "%s: device %s%d: " fmt, MODULE_NAME,	\
+				"/dev/"MODULE_NODE_NAME, (mycdev)->devID, ##__VA_ARGS__);	\
+	} while(0)
+
+
+/* Other global variables */
+static struct class *asp_mycdev_class = NULL;
+static struct workqueue_struct *asp_mycdev_wq = NULL;	/* frees cleared page stores */
+static struct vfsmount *asp_mycdev_mnt = NULL;	/* holds the inodes of the device mappings */
+static int asp_mycdev_mnt_count = 0;
+static bool chrdevRegistered = false;
+static bool ctlRegistered = false;
+static bool shrinkerRegistered = false;
+static struct crypto_comp * __percpu *asp_mycdev_tfms = NULL;	/* of ASP_MODE_COMPRESS, NULL if unavailable */
+
+/* Devices, allocated one by one and indexed by devID, the offset of the minor */
+static DEFINE_XARRAY_ALLOC(asp_mycdev_devices);
+static DEFINE_MUTEX(asp_mycdev_devices_lock);	/* serializes creation and destruction */
+/* one lock class per stripe index, they are always taken in ascending order */
+static struct lock_class_key asp_mycdev_stripe_keys[ASP_NR_STRIPES];
+
+/* Function declarations */
+static int mycdev_init_module(void);
+static void mycdev_cleanup_module(void);
+static int asp_mycdev_open(struct inode *, struct file *);
+static int asp_mycdev_release(struct inode *, struct file *);
+static ssize_t asp_mycdev_read_iter(struct kiocb *, struct iov_iter *);
+static ssize_t asp_mycdev_write_iter(struct kiocb *, struct iov_iter *);
+static loff_t asp_mycdev_lseek(struct file *, loff_t, int);
+static long asp_mycdev_ioctl(struct file *, unsigned int, unsigned long);
+static int asp_mycdev_mmap(struct file *, struct vm_area_struct *);
+static __poll_t asp_mycdev_poll(struct file *, poll_table *);
+static long asp_mycdev_snapshot(struct asp_mycdev *, s32 __user *);
+static struct file_operations asp_mycdev_fileops;
+
+/* Pseudo filesystem of the device mappings. Like /dev/mem, every device gets an
+inode of its own whose address_space all open files share, so that a clear can
+zap every mapping of the device, whichever node it was made through. */
+#define  ASP_MYCDEV_FS_MAGIC  0x6d796364
+
+static int asp_mycdev_init_fs_context(struct fs_context *fc)
+{
+	return init_pseudo(fc, ASP_MYCDEV_FS_MAGIC)? 0 : -ENOMEM;
+}
+
+static struct file_system_type asp_mycdev_fs_type = {
+	.name = MODULE_NAME,
+	.owner = THIS_MODULE,
+	.init_fs_context = asp_mycdev_init_fs_context,
+	.kill_sb = kill_anon_super,
+};
+
+
+/* Ramdisk page store helpers */
+/* pages of the current store, stable while resizeLock or mapLock is held */
+static inline struct xarray *asp_mycdev_pages(struct asp_mycdev *mycdev)
+{
+	return &rcu_dereference_protected(mycdev->store, lockdep_is_held(&mycdev->resizeLock) ||\
+		lockdep_is_held(&mycdev->mapLock))->pages;
+}
+
+
+/* the store behind asp_mycdev_pages */
+static inline struct asp_mycdev_store *asp_mycdev_store(struct asp_mycdev *mycdev)
+{
+	return container_of(asp_mycdev_pages(mycdev), struct asp_mycdev_store, pages);
+}
+
+
+/* Compressed entries of a page store. A page filled with one byte is a value
+entry holding the byte, a compressed page a tagged pointer to its struct
+asp_mycdev_zpage; xa_is_value() is true for both. Zero filled pages are dropped
+and become holes. */
+#define  ASP_ZPAGE_TAG  3
+
+static inline void *asp_mycdev_mk_fill(u8 byte)
+{
+	return xa_mk_value((unsigned long) byte << 1);
+}
+
+static inline u8 asp_mycdev_to_fill(void *entry)
+{
+	return xa_to_value(entry) >> 1;
+}
+
+static inline void *asp_mycdev_mk_zpage(struct asp_mycdev_zpage *zpage)
+{
+	return xa_tag_pointer(zpage, ASP_ZPAGE_TAG);
+}
+
+/* the compressed page of an entry, NULL for pages and same-filled entries */
+static inline struct asp_mycdev_zpage *asp_mycdev_to_zpage(void *entry)
+{
+	return (xa_pointer_tag(entry) == ASP_ZPAGE_TAG)? xa_untag_pointer(entry) : NULL;
+}
+
+
+/* allocate an empty page store */
+static struct asp_mycdev_store *asp_mycdev_store_alloc(void)
+{
+	struct asp_mycdev_store *store = kzalloc(sizeof(*store), GFP_KERNEL);
+
+	if(store != NULL)
+		xa_init(&store->pages);
+	return store;
+}
+
+
+/* drop the page or compressed page of an entry no store holds anymore */
+static void asp_mycdev_drop_entry(void *entry)
+{
+	if(xa_is_value(entry))
+		kfree(asp_mycdev_to_zpage(entry));
+	else if(entry != NULL)
+		put_page(entry);
+}
+
+
+/* drop every page of a store which nobody can reach anymore, and the store itself */
+static void asp_mycdev_store_free(struct asp_mycdev_store *store)
+{
+	unsigned long index = 0;
+	void *entry = NULL;
+
+	xa_for_each(&store->pages, index, entry) {
+		asp_mycdev_drop_entry(entry);
+		cond_resched();
+	}
+	xa_destroy(&store->pages);
+	kfree(store);
+}
+
+
+static void asp_mycdev_store_free_work(struct work_struct *work)
+{
+	asp_mycdev_store_free(container_of(to_rcu_work(work), struct asp_mycdev_store, free));
+}
+
+
+/**
+ * asp_mycdev_check_numa -
+ * @policy: ASP_NUMA_* policy
+ * @node: node of ASP_NUMA_FIXED
+ * Return: 0 if the placement can be used, -EINVAL otherwise
+ */
+static int asp_mycdev_check_numa(u32 policy, int node)
+{
+	if(policy > ASP_NUMA_MAX)
+		return -EINVAL;
+	if(policy == ASP_NUMA_FIXED && (node < 0 || node >= nr_node_ids || !node_online(node)))
+		return -EINVAL;
+	return 0;
+}
+
+
+/**
+ * asp_mycdev_page_node -
+ * @mycdev: device to populate
+ * @index: page index in the ramdisk
+ * Return: node the page at index should be allocated on, NUMA_NO_NODE for the local one
+ */
+static int asp_mycdev_page_node(struct asp_mycdev *mycdev, unsigned long index)
+{
+	unsigned int target = 0;
+	int node = NUMA_NO_NODE;
+
+	switch (READ_ONCE(mycdev->numaPolicy))
+	{
+		case ASP_NUMA_FIXED:
+			node = READ_ONCE(mycdev->numaNode);
+			break;
+
+		case ASP_NUMA_INTERLEAVE:
+			/* nodes may go offline meanwhile, then fall back to the local one */
+			target = index % num_online_nodes();
+			for(node = first_online_node; target > 0 && node < MAX_NUMNODES; target--)
+				node = next_online_node(node);
+			if(node >= MAX_NUMNODES)
+				node = NUMA_NO_NODE;
+			break;
+	}
+	return node;
+}
+
+
+/**
+ * asp_mycdev_alloc_huge -
+ * @mycdev: device in ASP_MODE_HUGE, allocLock is held by the caller
+ * @index: page index in the ramdisk, in a hole
+ * Description:
+ 		Fills the aligned block of ASP_HUGE_NR pages around index with the subpages
+		of one zeroed compound page, every entry holding a reference on it. The
+		block has to be empty and within the ramdisk size. Its entries are
+		reserved before any is filled, so the allocation can no longer fail once
+		the block becomes visible, and a reserved entry still reads as a hole.
+ * Return: the subpage at index, or NULL to fall back to a small page
+ */
+static struct page *asp_mycdev_alloc_huge(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct xarray *pages = asp_mycdev_pages(mycdev);
+	unsigned long first = round_down(index, ASP_HUGE_NR), i = first;
+	int node = asp_mycdev_page_node(mycdev, first);
+	struct page *head = NULL;
+
+	if(((first + ASP_HUGE_NR) << PAGE_SHIFT) > READ_ONCE(mycdev->ramdiskSize))
+		return NULL;
+	if(xa_find(pages, &i, first + ASP_HUGE_NR - 1, XA_PRESENT) != NULL)
+		return NULL;
+
+	head = alloc_pages_node(node, GFP_KERNEL_ACCOUNT | __GFP_ZERO | __GFP_COMP | __GFP_NOWARN |\
+		__GFP_NORETRY, ASP_HUGE_ORDER);
+	if(head == NULL)
+		goto FALLBACK;
+	SetPageUptodate(head);		/* the flag of the head covers the tail pages */
+	for(i = first; i < first + ASP_HUGE_NR; i++)
+		if(xa_reserve(pages, i, GFP_KERNEL_ACCOUNT))
+			goto FAIL;
+
+	page_ref_add(head, ASP_HUGE_NR - 1);
+	for(i = first; i < first + ASP_HUGE_NR; i++)
+		xa_store(pages, i, head + (i - first), GFP_KERNEL);		/* reserved, allocates nothing */
+	asp_mycdev_store(mycdev)->nrPages += ASP_HUGE_NR;
+
+	this_cpu_inc(mycdev->stats->hugePages);
+	if(node != NUMA_NO_NODE && page_to_nid(head) != node)
+		this_cpu_inc(mycdev->stats->numaMisses);
+	return head + (index - first);
+
+FAIL:
+	while(i-- > first)
+		xa_release(pages, i);
+	put_page(head);
+FALLBACK:
+	this_cpu_inc(mycdev->stats->hugeFallbacks);
+	return NULL;
+}
+
+
+/**
+ * asp_mycdev_alloc_page -
+ * @mycdev: device to populate
+ * @index: page index in the ramdisk, in a hole
+ * Description:
+ 		Devices are sparse: pages are only allocated when they are first written,
+		either by write or through a mapping, on the node numaPolicy picks; with
+		ASP_NUMA_LOCAL that is the node of the writer. In ASP_MODE_HUGE the whole
+		huge block around index is filled if possible. Concurrent first touches
+		serialize on allocLock, the later ones find the page of the first.
+		The caller holds resizeLock or mapLock, which keeps the store in place.
+ * Return: the page stored at index, or NULL if no memory is available
+ */
+static struct page *asp_mycdev_alloc_page(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct xarray *pages = asp_mycdev_pages(mycdev);
+	struct page *page = NULL;
+	int node = NUMA_NO_NODE;
+
+	mutex_lock(&mycdev->allocLock);
+	page = xa_load(pages, index);		/* filled while we waited */
+	if(page != NULL)
+		goto EXIT;
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_HUGE) {
+		page = asp_mycdev_alloc_huge(mycdev, index);
+		if(page != NULL)
+			goto EXIT;
+	}
+
+	node = asp_mycdev_page_node(mycdev, index);
+	page = alloc_pages_node(node, GFP_KERNEL_ACCOUNT | __GFP_ZERO, 0);
+	if(page == NULL)
+		goto EXIT;
+	/* splice hands our pages to pipes, which only take uptodate ones */
+	SetPageUptodate(page);
+	if(node != NUMA_NO_NODE && page_to_nid(page) != node)
+		this_cpu_inc(mycdev->stats->numaMisses);
+	if(xa_insert(pages, index, page, GFP_KERNEL_ACCOUNT)) {
+		put_page(page);
+		page = NULL;
+	}
+	else
+		asp_mycdev_store(mycdev)->nrPages++;
+
+EXIT:
+	mutex_unlock(&mycdev->allocLock);
+	return page;
+}
+
+
+/**
+ * asp_mycdev_unshare_page -
+ * @mycdev: device about to write the page
+ * @index: page index in the ramdisk, marked ASP_PAGE_SHARED
+ * Description:
+ 		Breaks the sharing with a snapshot: the page is copied into one private to
+		this device, which replaces it in the store, and mappings of the old one
+		are zapped. A huge block is copied as a whole, into a huge page again if
+		possible, so that no entry of a store ever points into a block shared with
+		another store unless all of them do. The other side keeps its mark and
+		copies once more on its next write, even if it is the last user by then.
+		Serialized with hole filling on allocLock, the caller holds resizeLock or
+		mapLock.
+ * Return: the private page stored at index, or NULL if no memory is available
+ */
+static struct page *asp_mycdev_unshare_page(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct xarray *pages = asp_mycdev_pages(mycdev);
+	struct page *old = NULL, *head = NULL, *huge = NULL, *page = NULL;
+	struct page *one = NULL, **copies = &one;
+	unsigned long first = index, nr = 1, i = 0;
+	int node = NUMA_NO_NODE;
+
+	mutex_lock(&mycdev->allocLock);
+	old = xa_load(pages, index);
+	if(!xa_get_mark(pages, index, ASP_PAGE_SHARED)) {	/* copied while we waited */
+		page = old;
+		goto EXIT;
+	}
+
+	head = compound_head(old);
+	if(PageHead(head)) {
+		first = index - (old - head);
+		nr = compound_nr(head);
+		copies = kmalloc_array(nr, sizeof(*copies), GFP_KERNEL);
+		if(copies == NULL)
+			goto EXIT;
+	}
+	node = asp_mycdev_page_node(mycdev, first);
+	if(nr > 1) {
+		huge = alloc_pages_node(node, GFP_KERNEL_ACCOUNT | __GFP_COMP | __GFP_NOWARN |\
+			__GFP_NORETRY, compound_order(head));
+		if(huge != NULL) {
+			page_ref_add(huge, nr - 1);		/* one reference per entry, as in asp_mycdev_alloc_huge */
+			SetPageUptodate(huge);
+		}
+	}
+
+	for(i = 0; i < nr; i++)
+	{
+		copies[i] = (huge != NULL)? huge + i : alloc_pages_node(node, GFP_KERNEL_ACCOUNT, 0);
+		if(copies[i] == NULL) {
+			while(i--)
+				put_page(copies[i]);
+			goto FREE;
+		}
+		copy_highpage(copies[i], head + i);
+		if(huge == NULL)
+			SetPageUptodate(copies[i]);
+	}
+
+	/* every entry of the block exists, replacing them allocates nothing */
+	for(i = 0; i < nr; i++) {
+		xa_store(pages, first + i, copies[i], GFP_KERNEL);
+		xa_clear_mark(pages, first + i, ASP_PAGE_SHARED);
+	}
+	unmap_mapping_range(mycdev->mapping, (loff_t) first << PAGE_SHIFT, nr << PAGE_SHIFT, 1);
+	for(i = 0; i < nr; i++)
+		put_page(head + i);
+	this_cpu_add(mycdev->stats->cowCopies, nr);
+	page = copies[index - first];
+
+FREE:
+	if(copies != &one)
+		kfree(copies);
+EXIT:
+	mutex_unlock(&mycdev->allocLock);
+	return page;
+}
+
+
+/**
+ * asp_mycdev_page_span -
+ * @page: page stored for pos
+ * @pos: offset in the ramdisk
+ * @offset: returns the offset of pos in the returned page
+ * Description:
+ 		A subpage of a huge block is copied through the head of its compound page,
+		so that one lookup covers the rest of the block
+ * Return: the page to copy from or to, page_size() of it is contiguous
+ */
+static inline struct page *asp_mycdev_page_span(struct page *page, loff_t pos, size_t *offset)
+{
+	struct page *head = compound_head(page);
+
+	*offset = ((page - head) << PAGE_SHIFT) + offset_in_page(pos);
+	return head;
+}
+
+
+/**
+ * asp_mycdev_free_pages -
+ * @mycdev: device whose ramdisk is to be released
+ * Description: Frees every page of the ramdisk and empties the page store
+ */
+static void asp_mycdev_free_pages(struct asp_mycdev *mycdev)
+{
+	struct asp_mycdev_store *store = rcu_dereference_protected(mycdev->store, true);
+
+	if(store != NULL)
+		asp_mycdev_store_free(store);
+	RCU_INIT_POINTER(mycdev->store, NULL);
+	mycdev->ramdiskSize = 0;
+}
+
+
+/**
+ * asp_mycdev_reset_store -
+ * @mycdev: device to clear, resizeLock is held exclusively by the caller
+ * @new_size: size of the ramdisk afterwards
+ * Description:
+ 		Clears the ramdisk in constant time: an empty store is swapped in and the
+		old one is released by asp_mycdev_wq once an RCU grace period has passed,
+		so that lockless readers, which back off on resizeSeq, are done with it.
+		Mappings of the device are zapped and fault in the new store afterwards.
+ * Return: 0 on success, -ENOMEM if no empty store could be allocated
+ */
+static int asp_mycdev_reset_store(struct asp_mycdev *mycdev, size_t new_size)
+{
+	struct asp_mycdev_store *store = asp_mycdev_store_alloc();
+	struct asp_mycdev_store *old = NULL;
+
+	if(store == NULL)
+		return -ENOMEM;
+
+	raw_write_seqcount_begin(&mycdev->resizeSeq);
+	down_write(&mycdev->mapLock);
+	old = rcu_replace_pointer(mycdev->store, store, true);
+	WRITE_ONCE(mycdev->ramdiskSize, new_size);
+	up_write(&mycdev->mapLock);
+	raw_write_seqcount_end(&mycdev->resizeSeq);
+
+	/* the ring header above the data area stays mapped */
+	unmap_mapping_range(mycdev->mapping, 0, ASP_RING_HEADER_OFFSET, 1);
+
+	INIT_RCU_WORK(&old->free, asp_mycdev_store_free_work);
+	queue_rcu_work(asp_mycdev_wq, &old->free);
+	return 0;
+}
+
+
+/**
+ * asp_mycdev_share_store -
+ * @source: device to take a snapshot of
+ * @snap: new device with an empty store, not live yet
+ * Description:
+ 		Makes snap a copy-on-write snapshot of source without copying any data:
+		every page is entered into both stores, with a reference for each, and
+		marked ASP_PAGE_SHARED on both sides. Compressed entries are duplicated. Mappings of source are zapped first
+		and fault back read-only, faults wait on mapLock until the marks are set.
+		Runs in time linear in the number of populated pages.
+ * Return: 0 on success, -EINVAL for FIFO and ring devices, -ENOMEM or -EINTR
+ */
+static int asp_mycdev_share_store(struct asp_mycdev *source, struct asp_mycdev *snap)
+{
+	struct asp_mycdev_store *to = rcu_dereference_protected(snap->store, true);
+	struct asp_mycdev_store *from = NULL;
+	unsigned long index = 0;
+	void *entry = NULL;
+	int retval = 0;
+
+	if(down_write_killable(&source->resizeLock))
+		return -EINTR;
+	if(source->mode & (ASP_MODE_FIFO | ASP_MODE_RING)) {	/* their contents are a stream */
+		retval = -EINVAL;
+		goto EXIT;
+	}
+
+	down_write(&source->mapLock);
+	unmap_mapping_range(source->mapping, 0, ASP_RING_HEADER_OFFSET, 1);
+	from = asp_mycdev_store(source);
+	xa_for_each(&from->pages, index, entry)
+	{
+		struct asp_mycdev_zpage *zpage = asp_mycdev_to_zpage(entry);
+		void *copy = entry;
+
+		/* compressed pages are small, they are copied rather than shared */
+		if(zpage != NULL) {
+			zpage = kmemdup(zpage, sizeof(*zpage) + zpage->len, GFP_KERNEL_ACCOUNT);
+			if(zpage == NULL) {
+				retval = -ENOMEM;
+				break;
+			}
+			copy = asp_mycdev_mk_zpage(zpage);
+		}
+		retval = xa_err(xa_store(&to->pages, index, copy, GFP_KERNEL_ACCOUNT));
+		if(retval) {
+			kfree(zpage);
+			break;
+		}
+		if(!xa_is_value(entry)) {
+			get_page(entry);
+			xa_set_mark(&from->pages, index, ASP_PAGE_SHARED);
+			xa_set_mark(&to->pages, index, ASP_PAGE_SHARED);
+		}
+		cond_resched();
+	}
+	to->nrPages = from->nrPages;
+	to->zpages = from->zpages;
+	to->zbytes = from->zbytes;
+	to->fillPages = from->fillPages;
+	snap->ramdiskSize = source->ramdiskSize;
+	snap->initialSize = source->ramdiskSize;
+	snap->maxSize = source->maxSize;
+	/* no append is in flight, the log is complete up to its tail */
+	atomic64_set(&snap->log.tail, atomic64_read(&source->log.tail));
+	atomic64_set(&snap->log.committed, atomic64_read(&source->log.committed));
+	snap->numaPolicy = source->numaPolicy;
+	snap->numaNode = source->numaNode;
+	up_write(&source->mapLock);
+
+EXIT:
+	up_write(&source->resizeLock);
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_get_page_rcu -
+ * @mycdev: device to look up
+ * @index: page index in the ramdisk
+ * Description:
+ 		Looks up a page without any device lock held and takes a reference on it,
+		using the same speculative protocol as the lockless page cache: the page
+		is only kept if its refcount was not zero and it is still the one stored
+		at index afterwards. Pages are always released with put_page, so a
+		lockless reader keeps a page alive even if it is dropped from the store,
+		and a cleared store is only released after an RCU grace period.
+ * Return: referenced page, NULL if index is not populated, ERR_PTR(-EAGAIN) if compressed
+ */
+static struct page *asp_mycdev_get_page_rcu(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct xarray *pages = NULL;
+	struct page *page = NULL;
+
+	rcu_read_lock();
+	pages = &rcu_dereference(mycdev->store)->pages;
+REPEAT:
+	page = xa_load(pages, index);
+	if(xa_is_value(page))		/* compressed, only the locked paths decompress */
+		page = ERR_PTR(-EAGAIN);
+	else if(page != NULL)
+	{
+		/* subpages of a huge block are pinned through their head */
+		if(!get_page_unless_zero(compound_head(page)))
+			goto REPEAT;
+		if(unlikely(page != xa_load(pages, index))) {
+			put_page(page);
+			goto REPEAT;
+		}
+	}
+	rcu_read_unlock();
+
+	return page;
+}
+
+
+/* Statistics helpers */
+/**
+ * asp_mycdev_hist_bucket -
+ * @ns: duration in nanoseconds
+ * Return: index of the log2 histogram bucket for ns
+ */
+static inline unsigned int asp_mycdev_hist_bucket(u64 ns)
+{
+	return min_t(unsigned int, fls64(ns), ASP_HIST_BUCKETS - 1);
+}
+
+
+/**
+ * asp_mycdev_account -
+ * @mycdev: device the operation ran on
+ * @op: operation to account
+ * @start: ktime_get_ns() at the start of the operation
+ * @ret: return value of the operation, bytes transferred for read and write
+ * Description: Counts a completed operation in the per-CPU statistics
+ */
+static void asp_mycdev_account(struct asp_mycdev *mycdev, enum asp_mycdev_op op,\
+	u64 start, ssize_t ret)
+{
+	unsigned int bucket = asp_mycdev_hist_bucket(ktime_get_ns() - start);
+
+	this_cpu_inc(mycdev->stats->ops[op]);
+	this_cpu_inc(mycdev->stats->latency[op][bucket]);
+	if(ret < 0)
+		this_cpu_inc(mycdev->stats->errors);
+	else if(op == ASP_OP_READ || op == ASP_OP_WRITE)
+		this_cpu_add(mycdev->stats->bytes[op], ret);
+}
+
+
+/**
+ * asp_mycdev_account_wait -
+ * @mycdev: device whose locks were waited for
+ * @start: ktime_get_ns() before the first lock was requested
+ * Description: Counts the time spent acquiring the device locks
+ */
+static inline void asp_mycdev_account_wait(struct asp_mycdev *mycdev, u64 start)
+{
+	this_cpu_inc(mycdev->stats->lockWait[asp_mycdev_hist_bucket(ktime_get_ns() - start)]);
+}
+
+
+/* Page access helpers */
+/* note an access of a page, idle pages are the ones ASP_MODE_COMPRESS compresses */
+static inline void asp_mycdev_mark_accessed(struct page *page)
+{
+	if(!PageReferenced(page))
+		SetPageReferenced(page);
+}
+
+
+/**
+ * asp_mycdev_restore_page -
+ * @mycdev: device being accessed
+ * @index: page index in the ramdisk, holding a compressed entry
+ * Description:
+ 		Decompresses a page of ASP_MODE_COMPRESS into a page of its own, which
+		replaces the compressed entry. Serialized with the other changes of the
+		store on allocLock, the caller holds resizeLock or mapLock.
+ * Return: the restored page, or NULL if no memory is available
+ */
+static struct page *asp_mycdev_restore_page(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct asp_mycdev_store *store = asp_mycdev_store(mycdev);
+	struct asp_mycdev_zpage *zpage = NULL;
+	struct page *page = NULL;
+	unsigned int len = PAGE_SIZE;
+	void *entry = NULL, *kaddr = NULL;
+	u64 start = 0;
+	int retval = 0;
+
+	mutex_lock(&mycdev->allocLock);
+	entry = xa_load(&store->pages, index);
+	if(!xa_is_value(entry)) {		/* restored while we waited */
+		page = entry;
+		goto EXIT;
+	}
+
+	page = alloc_pages_node(asp_mycdev_page_node(mycdev, index), GFP_KERNEL_ACCOUNT, 0);
+	if(page == NULL)
+		goto EXIT;
+	zpage = asp_mycdev_to_zpage(entry);
+	kaddr = kmap_local_page(page);
+	if(zpage != NULL)
+	{
+		start = ktime_get_ns();
+		retval = crypto_comp_decompress(*get_cpu_ptr(asp_mycdev_tfms), zpage->data, zpage->len,\
+			kaddr, &len);
+		put_cpu_ptr(asp_mycdev_tfms);
+		this_cpu_inc(mycdev->stats->decompressLatency[asp_mycdev_hist_bucket(ktime_get_ns() - start)]);
+	}
+	else
+		memset(kaddr, asp_mycdev_to_fill(entry), PAGE_SIZE);
+	kunmap_local(kaddr);
+	if(WARN_ON_ONCE(retval || len != PAGE_SIZE)) {	/* we compressed it ourselves */
+		put_page(page);
+		page = NULL;
+		goto EXIT;
+	}
+
+	SetPageUptodate(page);
+	xa_store(&store->pages, index, page, GFP_KERNEL);		/* replaces, allocates nothing */
+	store->nrPages++;
+	if(zpage != NULL) {
+		store->zpages--;
+		store->zbytes -= zpage->len;
+		kfree(zpage);
+	}
+	else
+		store->fillPages--;
+
+EXIT:
+	mutex_unlock(&mycdev->allocLock);
+	return page;
+}
+
+
+/**
+ * asp_mycdev_load_page -
+ * @mycdev: device to read
+ * @index: page index in the ramdisk
+ * Description:
+ 		Looks up the page at index for reading, decompressing it first if needed.
+		The caller holds resizeLock or mapLock.
+ * Return: the page, NULL for a hole, ERR_PTR(-ENOMEM) if it could not be decompressed
+ */
+static struct page *asp_mycdev_load_page(struct asp_mycdev *mycdev, unsigned long index)
+{
+	struct page *page = xa_load(asp_mycdev_pages(mycdev), index);
+
+	if(unlikely(xa_is_value(page))) {
+		page = asp_mycdev_restore_page(mycdev, index);
+		if(page == NULL)
+			return ERR_PTR(-ENOMEM);
+	}
+	if(page != NULL)
+		asp_mycdev_mark_accessed(page);
+	return page;
+}
+
+
+/**
+ * asp_mycdev_write_page -
+ * @mycdev: device to write
+ * @index: page index in the ramdisk
+ * Description:
+ 		Looks up the page at index for writing: holes are filled, compressed pages
+		decompressed and pages shared with a snapshot copied first. The caller
+		holds resizeLock or mapLock.
+ * Return: the page to write, or NULL if no memory is available
+ */
+static struct page *asp_mycdev_write_page(struct asp_mycdev *mycdev, unsigned long index)
+{
+	XA_STATE(xas, asp_mycdev_pages(mycdev), index);
+	struct page *page = NULL;
+	bool shared = false;
+
+	rcu_read_lock();
+	page = xas_load(&xas);
+	shared = (page != NULL) && xas_get_mark(&xas, ASP_PAGE_SHARED);
+	rcu_read_unlock();
+
+	if(page == NULL)		/* first write to a hole */
+		page = asp_mycdev_alloc_page(mycdev, index);
+	else if(unlikely(xa_is_value(page)))		/* compressed entries are never shared */
+		page = asp_mycdev_restore_page(mycdev, index);
+	else if(unlikely(shared))
+		page = asp_mycdev_unshare_page(mycdev, index);
+
+	if(page != NULL)
+		asp_mycdev_mark_accessed(page);
+	return page;
+}
+
+
+/* Range locking helpers */
+/**
+ * asp_mycdev_stripe_mask -
+ * @pos: first byte of the range
+ * @count: length of the range in bytes
+ * Description: Computes the set of stripes covering [pos, pos + count)
+ * Return: bitmask of stripe indices, all stripes for ranges spanning a full cycle
+ */
+static unsigned long asp_mycdev_stripe_mask(loff_t pos, size_t count)
+{
+	unsigned long first = 0, last = 0, unit = 0;
+	unsigned long mask = 0;
+
+	if(count == 0)
+		return 0;
+
+	first = pos >> ASP_STRIPE_SHIFT;
+	last = (pos + count - 1) >> ASP_STRIPE_SHIFT;
+	if(last - first >= ASP_NR_STRIPES - 1)
+		return GENMASK(ASP_NR_STRIPES - 1, 0);
+
+	for(unit = first; unit <= last; unit++)
+		mask |= BIT(unit % ASP_NR_STRIPES);
+	return mask;
+}
+
+
+/**
+ * asp_mycdev_lock_stripes -
+ * @mycdev: device whose stripes to lock, resizeLock is held by the caller
+ * @mask: stripes to lock
+ * @subclass: lockdep subclass, SINGLE_DEPTH_NESTING for the second device of a pair
+ * Description:
+ 		Takes the stripes in ascending order and interruptibly, as the device lock
+		they replace: on a signal the stripes already taken are dropped again.
+ * Return: 0 on success, -ERESTARTSYS if interrupted
+ */
+static int asp_mycdev_lock_stripes(struct asp_mycdev *mycdev, unsigned long mask,\
+	unsigned int subclass)
+{
+	unsigned int i = 0, j = 0;
+
+	for_each_set_bit(i, &mask, ASP_NR_STRIPES) {
+		if(mutex_lock_interruptible_nested(&mycdev->stripes[i].lock, subclass))
+			goto INTR;
+	}
+	return 0;
+
+INTR:
+	for_each_set_bit(j, &mask, i)
+		mutex_unlock(&mycdev->stripes[j].lock);
+	return -ERESTARTSYS;
+}
+
+
+/**
+ * asp_mycdev_lock_range -
+ * @mycdev: device to lock
+ * @mask: stripes to lock, from asp_mycdev_stripe_mask
+ * @nowait: only try the locks, for IOCB_NOWAIT requests
+ * Description:
+ 		Takes resizeLock shared, so that the size and the page store stay put, and
+		then the requested stripes in ascending order. I/O on disjoint stripes runs
+		concurrently, only resize and clear take resizeLock exclusively.
+ * Return:
+ 		0 on success, -ERESTARTSYS if interrupted while waiting for a resize or
+		a stripe, -EAGAIN if nowait is set and one of the locks is contended
+ */
+static int asp_mycdev_lock_range(struct asp_mycdev *mycdev, unsigned long mask, bool nowait)
+{
+	unsigned int i = 0, j = 0;
+	u64 start = 0;
+
+	if(nowait)
+	{
+		if(!down_read_trylock(&mycdev->resizeLock))
+			return -EAGAIN;
+		for_each_set_bit(i, &mask, ASP_NR_STRIPES) {
+			if(!mutex_trylock(&mycdev->stripes[i].lock))
+				goto BUSY;
+		}
+		return 0;
+	}
+
+	start = ktime_get_ns();
+	if(down_read_interruptible(&mycdev->resizeLock))
+		return -ERESTARTSYS;
+	if(asp_mycdev_lock_stripes(mycdev, mask, 0)) {
+		up_read(&mycdev->resizeLock);
+		return -ERESTARTSYS;
+	}
+	asp_mycdev_account_wait(mycdev, start);
+	return 0;
+
+BUSY:
+	/* drop the stripes below the contended one */
+	for_each_set_bit(j, &mask, i)
+		mutex_unlock(&mycdev->stripes[j].lock);
+	up_read(&mycdev->resizeLock);
+	return -EAGAIN;
+}
+
+
+/**
+ * asp_mycdev_write_begin -
+ * @mycdev: device being written
+ * @mask: stripes held by the writer
+ * Description:
+ 		Opens a write section on the stripes for lockless readers. The sections are
+		serialized by the stripe mutexes and may sleep (copy_from_user can fault):
+		lockless readers never spin on an odd sequence, they fall back to the locks.
+ */
+static void asp_mycdev_write_begin(struct asp_mycdev *mycdev, unsigned long mask)
+{
+	unsigned int i = 0;
+
+	for_each_set_bit(i, &mask, ASP_NR_STRIPES)
+		raw_write_seqcount_begin(&mycdev->stripes[i].seq);
+}
+
+
+/**
+ * asp_mycdev_write_end -
+ * @mycdev: device being written
+ * @mask: stripes passed to asp_mycdev_write_begin
+ * Description: Closes the write section opened by asp_mycdev_write_begin
+ */
+static void asp_mycdev_write_end(struct asp_mycdev *mycdev, unsigned long mask)
+{
+	unsigned int i = 0;
+
+	for_each_set_bit(i, &mask, ASP_NR_STRIPES)
+		raw_write_seqcount_end(&mycdev->stripes[i].seq);
+}
+
+
+/**
+ * asp_mycdev_unlock_range -
+ * @mycdev: device to unlock
+ * @mask: stripes passed to asp_mycdev_lock_range
+ * Description: Drops the stripes and resizeLock taken by asp_mycdev_lock_range
+ */
+static void asp_mycdev_unlock_range(struct asp_mycdev *mycdev, unsigned long mask)
+{
+	unsigned int i = 0;
+
+	for_each_set_bit(i, &mask, ASP_NR_STRIPES)
+		mutex_unlock(&mycdev->stripes[i].lock);
+	up_read(&mycdev->resizeLock);
+}
+
+
+/* Function definitions */
+/* open function */
+/**
+ * asp_mycdev_open -
+ * @i_ptr: pointer to current inode being pointed after open sys call
+ * @filp:	pointer to current file descriptor struct after open sys call
+ * Description:
+ 		Extracts the custom device struct from current cdev, and stores it in file's
+		private_data field
+ * Return: 0, Always succeeds
+ */
+static int asp_mycdev_open(struct inode *i_ptr, struct file *filp)
+{
+	struct asp_mycdev *mycdev = NULL;
+
+	/* Get the struct of current device */
+	mycdev = container_of(i_ptr->i_cdev, struct asp_mycdev, cdev);
+
+	/* Make device ready for future use */
+	mycdev->devReset = false;
+	filp->private_data = mycdev;		/* for later use by other functions */
+	filp->f_mode |= FMODE_NOWAIT;		/* read_iter/write_iter honour IOCB_NOWAIT */
+	filp->f_mapping = mycdev->mapping;		/* shared by every node of the device */
+
+	trace_asp_mycdev_open(mycdev->devID, i_ptr->i_rdev);
+	asp_dbg(mycdev, "opened [Major: %d, Minor: %d]\n", imajor(i_ptr), iminor(i_ptr));
+	return 0;
+}
+
+
+/* release function */
+/**
+ * asp_mycdev_release -
+ * @i_ptr: current inode being referred to`
+ * @filp: file descriptor pointer
+ * Description: Releases the device
+ * Return: 0, Always succeeds
+ */
+static int asp_mycdev_release(struct inode *i_ptr, struct file *filp)
+{
+	struct asp_mycdev *mycdev = filp->private_data;
+
+	trace_asp_mycdev_release(mycdev->devID, i_ptr->i_rdev);
+	asp_dbg(mycdev, "closed\n");
+	return 0;
+}
+
+
+/* page walkers shared by the read and write paths */
+/**
+ * asp_mycdev_copy_to_iter -
+ * @mycdev: device to read, the range is locked by the caller
+ * @pos: offset in the ramdisk
+ * @count: number of bytes to copy, within the ramdisk size
+ * @to: destination of the copy
+ * Description: Copies a range of the ramdisk into an iov_iter one page at a time, holes read as zeros
+ * Return: Number of bytes copied, -EFAULT or -ENOMEM if none could be copied
+ */
+static ssize_t asp_mycdev_copy_to_iter(struct asp_mycdev *mycdev, loff_t pos, size_t count,\
+	struct iov_iter *to)
+{
+	ssize_t retval = 0;
+
+	while(count > 0)
+	{
+		struct page *page = asp_mycdev_load_page(mycdev, pos >> PAGE_SHIFT);
+		size_t pageOffset = offset_in_page(pos);
+		size_t chunk = 0, copied = 0;
+
+		if(IS_ERR(page))
+			return (retval > 0)? retval : PTR_ERR(page);
+		if(page != NULL) {
+			page = asp_mycdev_page_span(page, pos, &pageOffset);
+			chunk = min_t(size_t, count, page_size(page) - pageOffset);
+			copied = copy_page_to_iter(page, pageOffset, chunk, to);
+		}
+		else {		/* a hole, reads as zeros */
+			chunk = min_t(size_t, count, PAGE_SIZE - pageOffset);
+			copied = iov_iter_zero(chunk, to);
+		}
+
+		retval += copied;
+		pos += copied;
+		count -= copied;
+		if(copied < chunk)		/* faulted on the user buffer */
+			return (retval > 0)? retval : -EFAULT;
+	}
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_copy_from_iter -
+ * @mycdev: device to write, the range is locked by the caller
+ * @pos: offset in the ramdisk
+ * @count: number of bytes to copy, within the ramdisk size
+ * @from: source of the copy
+ * Description:
+ 		Copies an iov_iter into a range of the ramdisk one page at a time, filling
+		holes with freshly allocated pages and copying pages shared with a snapshot
+ * Return: Number of bytes copied, -EFAULT or -ENOMEM if none could be copied
+ */
+static ssize_t asp_mycdev_copy_from_iter(struct asp_mycdev *mycdev, loff_t pos, size_t count,\
+	struct iov_iter *from)
+{
+	ssize_t retval = 0;
+
+	while(count > 0)
+	{
+		struct page *page = asp_mycdev_write_page(mycdev, pos >> PAGE_SHIFT);
+		size_t pageOffset = 0, chunk = 0, copied = 0;
+
+		if(page == NULL)
+			return (retval > 0)? retval : -ENOMEM;
+		page = asp_mycdev_page_span(page, pos, &pageOffset);
+		chunk = min_t(size_t, count, page_size(page) - pageOffset);
+		copied = copy_page_from_iter(page, pageOffset, chunk, from);
+
+		retval += copied;
+		pos += copied;
+		count -= copied;
+		if(copied < chunk)		/* faulted on the user buffer */
+			return (retval > 0)? retval : -EFAULT;
+	}
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_log_reset -
+ * @mycdev: device entering ASP_MODE_APPEND, or being cleared in it
+ * Description:
+ 		Empties the log. The caller holds resizeLock exclusively, appenders hold it
+		shared from their reservation to their commit, so none is in flight and
+		every record is committed.
+ */
+static void asp_mycdev_log_reset(struct asp_mycdev *mycdev)
+{
+	struct asp_mycdev_log_done *done = NULL, *tmp = NULL;
+
+	WARN_ON_ONCE(!list_empty(&mycdev->log.done));
+	list_for_each_entry_safe(done, tmp, &mycdev->log.done, list) {
+		list_del(&done->list);
+		kfree(done);
+	}
+	atomic64_set(&mycdev->log.tail, 0);
+	atomic64_set_release(&mycdev->log.committed, 0);
+}
+
+
+/**
+ * asp_mycdev_log_commit -
+ * @mycdev: device in ASP_MODE_APPEND
+ * @start: offset of the copied record
+ * @end: end of the record, where the next one starts
+ * @done: preallocated entry for log.done, taken over if it is used
+ * Description:
+ 		Publishes a copied record without waiting for anybody. If records before it
+		are still being copied it is left in log.done, and the appender which
+		completes the lowest outstanding record moves log.committed past every
+		record completed behind it.
+ * Return: true if done was queued and must not be freed by the caller
+ */
+static bool asp_mycdev_log_commit(struct asp_mycdev *mycdev, s64 start, s64 end,\
+	struct asp_mycdev_log_done *done)
+{
+	struct asp_mycdev_log_done *next = NULL, *tmp = NULL;
+	s64 committed = 0;
+	bool queued = false;
+
+	spin_lock(&mycdev->log.lock);
+	committed = atomic64_read(&mycdev->log.committed);
+	if(committed != start)
+	{
+		/* keep log.done sorted, a record usually completes after the ones before it */
+		list_for_each_entry_reverse(next, &mycdev->log.done, list)
+			if(next->start < start)
+				break;
+		done->start = start;
+		done->end = end;
+		list_add(&done->list, &next->list);
+		queued = true;
+	}
+	else
+	{
+		committed = end;
+		list_for_each_entry_safe(next, tmp, &mycdev->log.done, list) {
+			if(next->start != committed)
+				break;
+			committed = next->end;
+			list_del(&next->list);
+			kfree(next);
+		}
+		atomic64_set_release(&mycdev->log.committed, committed);
+	}
+	spin_unlock(&mycdev->log.lock);
+	return queued;
+}
+
+
+/* end of the readable data: the size, or the committed records of a log */
+static loff_t asp_mycdev_read_end(struct asp_mycdev *mycdev)
+{
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_APPEND)
+		return atomic64_read_acquire(&mycdev->log.committed);
+	return READ_ONCE(mycdev->ramdiskSize);
+}
+
+
+/* lockless read */
+/**
+ * asp_mycdev_read_lockless -
+ * @mycdev: device to read, in ASP_MODE_LOCKLESS_READ
+ * @pos: offset in the ramdisk
+ * @to: destination of the read
+ * Description:
+ 		Optimistic read which takes no lock at all. The sequence counts of the
+		stripes covering the range and of the device are sampled, the pages are
+		copied under a reference from asp_mycdev_get_page_rcu, and the copy is
+		only accepted if none of the counts moved meanwhile, i.e. no write or
+		clear touched the range. Otherwise the iterator is rewound and the copy
+		retried a few times.
+ * Return:
+ 		Number of bytes read, -EFAULT, or -EAGAIN if the read kept racing with
+		writers and has to be done under the locks instead
+ */
+static ssize_t asp_mycdev_read_lockless(struct asp_mycdev *mycdev, loff_t pos,\
+	struct iov_iter *to)
+{
+	unsigned long mask = asp_mycdev_stripe_mask(pos, iov_iter_count(to));
+	unsigned int seq[ASP_NR_STRIPES] = { 0 };
+	unsigned int resizeSeq = 0;
+	unsigned int attempt = 0, i = 0;
+
+	for(attempt = 0; attempt < ASP_LOCKLESS_READ_RETRIES; attempt++)
+	{
+		loff_t cur = pos;
+		size_t size = 0, count = 0;
+		ssize_t retval = 0;
+		bool raced = false;
+
+		/* an odd count means a writer is in the middle of the range */
+		resizeSeq = raw_read_seqcount(&mycdev->resizeSeq);
+		raced = resizeSeq & 1;
+		for_each_set_bit(i, &mask, ASP_NR_STRIPES) {
+			seq[i] = raw_read_seqcount(&mycdev->stripes[i].seq);
+			raced |= seq[i] & 1;
+		}
+		if(raced)
+			continue;
+
+		size = asp_mycdev_read_end(mycdev);
+		if(pos >= size)
+			return 0;
+		count = min_t(size_t, iov_iter_count(to), size - pos);
+
+		while(count > 0)
+		{
+			struct page *page = asp_mycdev_get_page_rcu(mycdev, cur >> PAGE_SHIFT);
+			size_t pageOffset = offset_in_page(cur);
+			size_t chunk = min_t(size_t, count, PAGE_SIZE - pageOffset);
+			size_t copied = 0;
+
+			if(IS_ERR(page)) {		/* compressed, let the locked path decompress it */
+				if(retval > 0)
+					iov_iter_revert(to, retval);
+				return -EAGAIN;
+			}
+			if(page != NULL) {
+				asp_mycdev_mark_accessed(page);
+				copied = copy_page_to_iter(page, pageOffset, chunk, to);
+				put_page(page);
+			}
+			else		/* a hole, or filled meanwhile which the recheck catches */
+				copied = iov_iter_zero(chunk, to);
+
+			retval += copied;
+			cur += copied;
+			count -= copied;
+			if(copied < chunk) {
+				retval = (retval > 0)? retval : -EFAULT;
+				break;
+			}
+		}
+
+		/* accept the copy only if nobody wrote to the range meanwhile */
+		raced = read_seqcount_retry(&mycdev->resizeSeq, resizeSeq);
+		for_each_set_bit(i, &mask, ASP_NR_STRIPES)
+			raced |= read_seqcount_retry(&mycdev->stripes[i].seq, seq[i]);
+		if(!raced)
+			return retval;
+		if(retval > 0)
+			iov_iter_revert(to, retval);
+	}
+	return -EAGAIN;
+}
+
+
+/* FIFO mode */
+/**
+ * asp_mycdev_fifo_lock -
+ * @mycdev: device in ASP_MODE_FIFO
+ * @nowait: only try the locks, for IOCB_NOWAIT requests
+ * Description:
+ 		Takes resizeLock shared, which keeps the ring capacity and the mode stable,
+		and the FIFO mutex. Both are always dropped before sleeping on a wait queue.
+ * Return: 0 on success, -ERESTARTSYS if interrupted, -EAGAIN if nowait and contended
+ */
+static int asp_mycdev_fifo_lock(struct asp_mycdev *mycdev, bool nowait)
+{
+	u64 start = ktime_get_ns();
+
+	if(nowait)
+	{
+		if(!down_read_trylock(&mycdev->resizeLock))
+			return -EAGAIN;
+		if(!mutex_trylock(&mycdev->fifo.lock)) {
+			up_read(&mycdev->resizeLock);
+			return -EAGAIN;
+		}
+		return 0;
+	}
+
+	if(down_read_interruptible(&mycdev->resizeLock))
+		return -ERESTARTSYS;
+	if(mutex_lock_interruptible(&mycdev->fifo.lock)) {
+		up_read(&mycdev->resizeLock);
+		return -ERESTARTSYS;
+	}
+	asp_mycdev_account_wait(mycdev, start);
+	return 0;
+}
+
+
+static void asp_mycdev_fifo_unlock(struct asp_mycdev *mycdev)
+{
+	mutex_unlock(&mycdev->fifo.lock);
+	up_read(&mycdev->resizeLock);
+}
+
+
+/* wait queue conditions, also true once the device left FIFO mode */
+static bool asp_mycdev_fifo_readable(struct asp_mycdev *mycdev)
+{
+	return READ_ONCE(mycdev->fifo.tail) != READ_ONCE(mycdev->fifo.head) ||\
+		!(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO);
+}
+
+static bool asp_mycdev_fifo_writable(struct asp_mycdev *mycdev, size_t needed)
+{
+	return READ_ONCE(mycdev->fifo.tail) - READ_ONCE(mycdev->fifo.head) + needed <=\
+		READ_ONCE(mycdev->ramdiskSize) || !(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO);
+}
+
+
+/**
+ * asp_mycdev_fifo_reset -
+ * @mycdev: device entering or leaving FIFO mode, or being cleared
+ * Description:
+ 		Empties the ring and wakes up every sleeper so that they re-evaluate the
+		state. The caller holds resizeLock exclusively.
+ */
+static void asp_mycdev_fifo_reset(struct asp_mycdev *mycdev)
+{
+	WRITE_ONCE(mycdev->fifo.head, 0);
+	WRITE_ONCE(mycdev->fifo.tail, 0);
+	wake_up_interruptible_all(&mycdev->fifo.readq);
+	wake_up_interruptible_all(&mycdev->fifo.writeq);
+}
+
+
+/**
+ * asp_mycdev_ring_to_iter -
+ * @mycdev: device in ASP_MODE_FIFO, the FIFO is locked by the caller
+ * @pos: stream position to start at, taken modulo the ring size
+ * @count: number of queued bytes to copy
+ * @to: destination of the copy
+ * Description: Copies out of the ring buffer, wrapping around its end once
+ * Return: Number of bytes copied, -EFAULT if none could be copied
+ */
+static ssize_t asp_mycdev_ring_to_iter(struct asp_mycdev *mycdev, u64 pos, size_t count,\
+	struct iov_iter *to)
+{
+	u64 offset = 0;
+	size_t first = 0;
+	ssize_t retval = 0, more = 0;
+
+	div64_u64_rem(pos, mycdev->ramdiskSize, &offset);
+	first = min_t(size_t, count, mycdev->ramdiskSize - offset);
+	retval = asp_mycdev_copy_to_iter(mycdev, offset, first, to);
+	if(retval == first && count > first) {
+		more = asp_mycdev_copy_to_iter(mycdev, 0, count - first, to);
+		retval += max_t(ssize_t, more, 0);
+	}
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_ring_from_iter -
+ * @mycdev: device in ASP_MODE_FIFO, the FIFO is locked by the caller
+ * @pos: stream position to start at, taken modulo the ring size
+ * @count: number of bytes to copy, at most the free space of the ring
+ * @from: source of the copy
+ * Description: Copies into the ring buffer, wrapping around its end once
+ * Return: Number of bytes copied, -EFAULT if none could be copied
+ */
+static ssize_t asp_mycdev_ring_from_iter(struct asp_mycdev *mycdev, u64 pos, size_t count,\
+	struct iov_iter *from)
+{
+	u64 offset = 0;
+	size_t first = 0;
+	ssize_t retval = 0, more = 0;
+
+	div64_u64_rem(pos, mycdev->ramdiskSize, &offset);
+	first = min_t(size_t, count, mycdev->ramdiskSize - offset);
+	retval = asp_mycdev_copy_from_iter(mycdev, offset, first, from);
+	if(retval == first && count > first) {
+		more = asp_mycdev_copy_from_iter(mycdev, 0, count - first, from);
+		retval += max_t(ssize_t, more, 0);
+	}
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_fifo_read -
+ * @mycdev: device in ASP_MODE_FIFO
+ * @iocb: kernel I/O control block of the read
+ * @to: destination of the read
+ * Description:
+ 		Consumes up to iov_iter_count(to) queued bytes. Sleeps until there is data
+		unless the file is O_NONBLOCK or the request IOCB_NOWAIT, in which case an
+		empty ring gives -EAGAIN. Writers waiting for space are woken up.
+ * Return: Number of bytes read, 0 if the device left FIFO mode, or an error
+ */
+static ssize_t asp_mycdev_fifo_read(struct asp_mycdev *mycdev, struct kiocb *iocb,\
+	struct iov_iter *to)
+{
+	bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	size_t avail = 0;
+	ssize_t retval = 0;
+
+	if(iov_iter_count(to) == 0)
+		return 0;
+
+	for(;;)
+	{
+		retval = asp_mycdev_fifo_lock(mycdev, iocb->ki_flags & IOCB_NOWAIT);
+		if(retval)
+			return retval;
+		if(!(mycdev->mode & ASP_MODE_FIFO))		/* mode changed while we slept */
+			goto EXIT;
+		avail = mycdev->fifo.tail - mycdev->fifo.head;
+		if(avail > 0)
+			break;
+		asp_mycdev_fifo_unlock(mycdev);
+
+		if(nonblock)
+			return -EAGAIN;
+		if(wait_event_interruptible(mycdev->fifo.readq, asp_mycdev_fifo_readable(mycdev)))
+			return -ERESTARTSYS;
+	}
+
+	retval = asp_mycdev_ring_to_iter(mycdev, mycdev->fifo.head,\
+		min_t(size_t, avail, iov_iter_count(to)), to);
+	if(retval > 0)
+		WRITE_ONCE(mycdev->fifo.head, mycdev->fifo.head + retval);
+
+EXIT:
+	asp_mycdev_fifo_unlock(mycdev);
+	if(retval > 0)
+		wake_up_interruptible_poll(&mycdev->fifo.writeq, EPOLLOUT | EPOLLWRNORM);
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_fifo_write -
+ * @mycdev: device in ASP_MODE_FIFO
+ * @iocb: kernel I/O control block of the write
+ * @from: source of the write
+ * Description:
+ 		Queues the whole of from, sleeping for space as often as needed. As for
+		pipes, writes of up to PIPE_BUF bytes are queued in one piece and never
+		interleave with other writers. O_NONBLOCK and IOCB_NOWAIT writers queue
+		what fits and get -EAGAIN if nothing does. Readers are woken up.
+ * Return: Number of bytes written, or an error if nothing was written
+ */
+static ssize_t asp_mycdev_fifo_write(struct asp_mycdev *mycdev, struct kiocb *iocb,\
+	struct iov_iter *from)
+{
+	bool nonblock = (iocb->ki_filp->f_flags & O_NONBLOCK) || (iocb->ki_flags & IOCB_NOWAIT);
+	size_t needed = (iov_iter_count(from) <= PIPE_BUF)? iov_iter_count(from) : 1;
+	ssize_t written = 0, retval = 0;
+
+	needed = min_t(size_t, needed, READ_ONCE(mycdev->ramdiskSize));
+	while(iov_iter_count(from) > 0)
+	{
+		size_t space = 0, count = 0;
+
+		retval = asp_mycdev_fifo_lock(mycdev, iocb->ki_flags & IOCB_NOWAIT);
+		if(retval)
+			break;
+		if(!(mycdev->mode & ASP_MODE_FIFO)) {		/* mode changed while we slept */
+			asp_mycdev_fifo_unlock(mycdev);
+			retval = -EIO;
+			break;
+		}
+		space = mycdev->ramdiskSize - (mycdev->fifo.tail - mycdev->fifo.head);
+		if(space < needed)
+		{
+			asp_mycdev_fifo_unlock(mycdev);
+			if(nonblock) {
+				retval = -EAGAIN;
+				break;
+			}
+			if(wait_event_interruptible(mycdev->fifo.writeq,\
+				asp_mycdev_fifo_writable(mycdev, needed))) {
+				retval = -ERESTARTSYS;
+				break;
+			}
+			continue;
+		}
+
+		count = min_t(size_t, space, iov_iter_count(from));
+		mycdev->devReset = false;
+		retval = asp_mycdev_ring_from_iter(mycdev, mycdev->fifo.tail, count, from);
+		if(retval > 0) {
+			WRITE_ONCE(mycdev->fifo.tail, mycdev->fifo.tail + retval);
+			written += retval;
+		}
+		asp_mycdev_fifo_unlock(mycdev);
+
+		if(retval > 0)
+			wake_up_interruptible_poll(&mycdev->fifo.readq, EPOLLIN | EPOLLRDNORM);
+		if(retval < (ssize_t) count)		/* faulted on the user buffer */
+			break;
+		needed = 1;
+	}
+	return (written > 0)? written : retval;
+}
+
+
+/* shared ring mode */
+/**
+ * asp_mycdev_ring_reset -
+ * @mycdev: device entering ASP_MODE_RING, or being cleared in it
+ * Description:
+ 		Allocates the shared header on first use, empties the ring and publishes
+		the current ramdisk size as its capacity. The header page is kept until
+		the module goes away, so mmap and poll can use it without locks.
+		The caller holds resizeLock exclusively.
+ * Return: 0 on success, -ENOMEM if the header page could not be allocated
+ */
+static int asp_mycdev_ring_reset(struct asp_mycdev *mycdev)
+{
+	struct page *page = mycdev->ring.page;
+	struct asp_mycdev_ring *ring = NULL;
+
+	if(page == NULL)
+	{
+		page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if(page == NULL)
+			return -ENOMEM;
+		smp_store_release(&mycdev->ring.page, page);
+	}
+	ring = page_address(page);
+	WRITE_ONCE(ring->head, 0);
+	WRITE_ONCE(ring->tail, 0);
+	WRITE_ONCE(ring->waiting, 0);
+	WRITE_ONCE(ring->size, mycdev->ramdiskSize);
+	return 0;
+}
+
+
+/**
+ * asp_mycdev_ring_kick -
+ * @mycdev: device in ASP_MODE_RING
+ * @bells: ASP_RING_KICK_* doorbells to ring
+ * Description:
+ 		Wakes up the poll() sleepers and signals the eventfd of every doorbell.
+		The FIFO wait queues double as the doorbells of the ring. The caller
+		holds resizeLock shared, which keeps the eventfds in place.
+ * Return: 0 on success, -EINVAL if not in ASP_MODE_RING or for unknown bells
+ */
+static long asp_mycdev_ring_kick(struct asp_mycdev *mycdev, unsigned long bells)
+{
+	if(!(mycdev->mode & ASP_MODE_RING) || (bells & ~(ASP_RING_KICK_DATA | ASP_RING_KICK_SPACE)))
+		return -EINVAL;
+
+	if(bells & ASP_RING_KICK_DATA)
+	{
+		wake_up_interruptible_poll(&mycdev->fifo.readq, EPOLLIN | EPOLLRDNORM);
+		if(mycdev->ring.dataEvent != NULL)
+			eventfd_signal(mycdev->ring.dataEvent, 1);
+	}
+	if(bells & ASP_RING_KICK_SPACE)
+	{
+		wake_up_interruptible_poll(&mycdev->fifo.writeq, EPOLLOUT | EPOLLWRNORM);
+		if(mycdev->ring.spaceEvent != NULL)
+			eventfd_signal(mycdev->ring.spaceEvent, 1);
+	}
+	return 0;
+}
+
+
+/* drop the references to the doorbell eventfds */
+static void asp_mycdev_ring_put_eventfds(struct asp_mycdev *mycdev)
+{
+	if(mycdev->ring.dataEvent != NULL)
+		eventfd_ctx_put(mycdev->ring.dataEvent);
+	if(mycdev->ring.spaceEvent != NULL)
+		eventfd_ctx_put(mycdev->ring.spaceEvent);
+	mycdev->ring.dataEvent = NULL;
+	mycdev->ring.spaceEvent = NULL;
+}
+
+
+/**
+ * asp_mycdev_ring_set_eventfd -
+ * @mycdev: device to set the doorbell eventfds of
+ * @uarg: struct asp_mycdev_ring_eventfd in user space
+ * Description:
+ 		Replaces both doorbell eventfds, a negative fd leaves its doorbell
+		without one. The caller holds resizeLock exclusively.
+ * Return: 0 on success, -EFAULT, -EBADF or -EINVAL for a bad argument
+ */
+static long asp_mycdev_ring_set_eventfd(struct asp_mycdev *mycdev,\
+	struct asp_mycdev_ring_eventfd __user *uarg)
+{
+	struct asp_mycdev_ring_eventfd fds = { 0 };
+	struct eventfd_ctx *dataEvent = NULL, *spaceEvent = NULL;
+
+	if(copy_from_user(&fds, uarg, sizeof(fds)))
+		return -EFAULT;
+
+	if(fds.dataFd >= 0)
+	{
+		dataEvent = eventfd_ctx_fdget(fds.dataFd);
+		if(IS_ERR(dataEvent))
+			return PTR_ERR(dataEvent);
+	}
+	if(fds.spaceFd >= 0)
+	{
+		spaceEvent = eventfd_ctx_fdget(fds.spaceFd);
+		if(IS_ERR(spaceEvent)) {
+			if(dataEvent != NULL)
+				eventfd_ctx_put(dataEvent);
+			return PTR_ERR(spaceEvent);
+		}
+	}
+
+	asp_mycdev_ring_put_eventfds(mycdev);
+	mycdev->ring.dataEvent = dataEvent;
+	mycdev->ring.spaceEvent = spaceEvent;
+	return 0;
+}
+
+
+/**
+ * asp_mycdev_ring_poll -
+ * @mycdev: device in ASP_MODE_RING
+ * @filp: file pointer
+ * @wait: poll table of the caller
+ * Description:
+ 		Evaluates the shared indices after queueing on both doorbells, so a kick
+		which follows the publication of an index can not be missed.
+ * Return: EPOLLIN while the ring has data, EPOLLOUT while it has room
+ */
+static __poll_t asp_mycdev_ring_poll(struct asp_mycdev *mycdev, struct file *filp,\
+	poll_table *wait)
+{
+	struct page *page = smp_load_acquire(&mycdev->ring.page);
+	struct asp_mycdev_ring *ring = NULL;
+	__poll_t mask = 0;
+	u64 head = 0, tail = 0;
+
+	poll_wait(filp, &mycdev->fifo.readq, wait);
+	poll_wait(filp, &mycdev->fifo.writeq, wait);
+
+	if(page == NULL)
+		return 0;
+	ring = page_address(page);
+	head = smp_load_acquire(&ring->head);
+	tail = smp_load_acquire(&ring->tail);
+
+	if(tail != head)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if(tail - head < READ_ONCE(ring->size))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+
+/**
+ * asp_mycdev_ring_mmap -
+ * @mycdev: device in ASP_MODE_RING
+ * @vma: the new mapping, at ASP_RING_HEADER_OFFSET
+ * Description:
+ 		Maps the shared header of the ring. The page is inserted right away as it
+		lives until the module is unloaded, no lock is needed for it.
+ * Return: 0 on success, -EINVAL if not in ASP_MODE_RING or not a single page
+ */
+static int asp_mycdev_ring_mmap(struct asp_mycdev *mycdev, struct vm_area_struct *vma)
+{
+	struct page *page = smp_load_acquire(&mycdev->ring.page);
+
+	if(!(READ_ONCE(mycdev->mode) & ASP_MODE_RING) || page == NULL)
+		return -EINVAL;
+	if(vma->vm_end - vma->vm_start != PAGE_SIZE)
+		return -EINVAL;
+
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	return vm_insert_page(vma, vma->vm_start, page);
+}
+
+
+/* release the ring header and doorbells at module exit */
+static void asp_mycdev_ring_free(struct asp_mycdev *mycdev)
+{
+	asp_mycdev_ring_put_eventfds(mycdev);
+	if(mycdev->ring.page != NULL)
+		put_page(mycdev->ring.page);
+	mycdev->ring.page = NULL;
+}
+
+
+/**
+ * asp_mycdev_poll -
+ * @filp: file pointer
+ * @wait: poll table of the caller
+ * Description:
+ 		In FIFO mode the device is readable while data is queued and writable while
+		the ring has room, in ring mode the same holds for the shared ring.
+		Random access devices are always readable and writable.
+ * Return: mask of EPOLL* events ready on the device
+ */
+static __poll_t asp_mycdev_poll(struct file *filp, poll_table *wait)
+{
+	struct asp_mycdev *mycdev = filp->private_data;
+	__poll_t mask = 0;
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_RING)
+		return asp_mycdev_ring_poll(mycdev, filp, wait);
+	if(!(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO))
+		return EPOLLIN | EPOLLRDNORM | EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &mycdev->fifo.readq, wait);
+	poll_wait(filp, &mycdev->fifo.writeq, wait);
+
+	if(READ_ONCE(mycdev->fifo.tail) != READ_ONCE(mycdev->fifo.head))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if(READ_ONCE(mycdev->fifo.tail) - READ_ONCE(mycdev->fifo.head) < READ_ONCE(mycdev->ramdiskSize))
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+
+/* sliced transfers */
+/**
+ * asp_mycdev_rw_slices -
+ * @mycdev: device to read or write, not in ASP_MODE_FIFO
+ * @iocb: kernel I/O control block, ki_pos is where the transfer starts
+ * @iter: source or destination of the transfer
+ * @write: true to write the device, false to read it
+ * Description:
+ 		Serves a locked read or write in slices of at most ASP_IO_SLICE bytes which
+		never cross a stripe unit, so each slice holds one stripe and the locks are
+		dropped between slices: a bulk transfer delays the small requests of other
+		tasks by one slice at most instead of its whole length. Every slice is
+		atomic against other I/O, a transfer larger than a slice as a whole is not.
+		The task may be rescheduled between slices and a fatal signal ends the
+		transfer early, as does a short copy or a device shrunk meanwhile.
+		IOCB_NOWAIT requests get -EAGAIN instead of sleeping on the locks of the
+		first slice, and the bytes done so far on a later one.
+ * Return: Number of bytes transferred, or the error of the first slice
+ */
+static ssize_t asp_mycdev_rw_slices(struct asp_mycdev *mycdev, struct kiocb *iocb,\
+	struct iov_iter *iter, bool write)
+{
+	size_t count = iov_iter_count(iter);
+	loff_t pos = iocb->ki_pos;
+	ssize_t retval = 0, done = 0;
+
+	while(count > 0)
+	{
+		size_t slice = min_t(size_t, count, ASP_IO_SLICE - (pos & (ASP_IO_SLICE - 1)));
+		unsigned long mask = asp_mycdev_stripe_mask(pos, slice);
+
+		/* ENTER Critical Section */
+		retval = asp_mycdev_lock_range(mycdev, mask, iocb->ki_flags & IOCB_NOWAIT);
+		if(retval)
+			break;
+		if(write && (slice + pos) > mycdev->ramdiskSize)	/* shrunk by a clear meanwhile */
+			retval = -ENOMEM;
+		else if(write) {
+			mycdev->devReset = false;
+			asp_mycdev_write_begin(mycdev, mask);
+			retval = asp_mycdev_copy_from_iter(mycdev, pos, slice, iter);
+			asp_mycdev_write_end(mycdev, mask);
+		}
+		else if(pos < asp_mycdev_read_end(mycdev)) {
+			/* read only upto the device size, or the end of the log */
+			slice = min_t(size_t, slice, asp_mycdev_read_end(mycdev) - pos);
+			retval = asp_mycdev_copy_to_iter(mycdev, pos, slice, iter);
+		}
+		asp_mycdev_unlock_range(mycdev, mask);			/* EXIT Critical Section */
+
+		if(retval <= 0)
+			break;
+		done += retval;
+		pos += retval;
+		count -= retval;
+		if((size_t) retval < slice || fatal_signal_pending(current))
+			break;
+		if(count > 0)
+			cond_resched();
+	}
+	return (done > 0)? done : retval;
+}
+
+
+/* ASP_MODE_APPEND */
+/**
+ * asp_mycdev_append -
+ * @mycdev: device in ASP_MODE_APPEND
+ * @iocb: kernel I/O control block, ki_pos is set to where the record lands
+ * @from: the record
+ * Description:
+ 		Appends one record at the tail of the log, whatever the file position. The
+		range is reserved by a compare-and-swap of log.tail, which only repeats if
+		another appender got in between, and then copied in slices under the
+		stripe locks alone: appenders in different stripe units copy in parallel
+		and records never interleave. Records are published in log order by
+		asp_mycdev_log_commit, which never waits for the appenders before: a
+		stalled one only holds back log.committed, where reads stop. resizeLock is
+		held shared from the reservation to the commit, so that a clear or a mode
+		switch finds no append in flight.
+		A short copy, or a signal while waiting for a stripe, hands back the
+		unwritten part of the reservation if nothing was reserved behind it,
+		otherwise that part is committed as it is.
+		IOCB_NOWAIT only applies to resizeLock, the stripes are held by the copies
+		of other appenders at most.
+ * Return: Number of bytes appended, -ENOMEM if the log does not fit the device
+ */
+static ssize_t asp_mycdev_append(struct asp_mycdev *mycdev, struct kiocb *iocb,\
+	struct iov_iter *from)
+{
+	size_t count = iov_iter_count(from);
+	struct asp_mycdev_log_done *entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	s64 pos = 0, end = 0;
+	ssize_t retval = 0, done = 0;
+
+	/* allocated up front, a copied record must always be committed */
+	if(entry == NULL)
+		return -ENOMEM;
+	if(iocb->ki_flags & IOCB_NOWAIT) {
+		if(!down_read_trylock(&mycdev->resizeLock)) {
+			kfree(entry);
+			return -EAGAIN;
+		}
+	}
+	else if(down_read_interruptible(&mycdev->resizeLock)) {
+		kfree(entry);
+		return -ERESTARTSYS;
+	}
+
+	/* reserve [pos, end) */
+	pos = atomic64_read(&mycdev->log.tail);
+	do {
+		end = pos + count;
+		if(end > (s64) mycdev->ramdiskSize) {
+			retval = -ENOMEM;
+			goto EXIT;
+		}
+	} while(!atomic64_try_cmpxchg(&mycdev->log.tail, &pos, end));
+
+	mycdev->devReset = false;
+	while((size_t) done < count)
+	{
+		loff_t cur = pos + done;
+		size_t slice = min_t(size_t, count - done, ASP_IO_SLICE - (cur & (ASP_IO_SLICE - 1)));
+		unsigned long mask = asp_mycdev_stripe_mask(cur, slice);
+		unsigned int i = 0;
+
+		/* a signal ends the record short, as a fault in the user buffer does */
+		retval = asp_mycdev_lock_stripes(mycdev, mask, 0);
+		if(retval)
+			break;
+		asp_mycdev_write_begin(mycdev, mask);
+		retval = asp_mycdev_copy_from_iter(mycdev, cur, slice, from);
+		asp_mycdev_write_end(mycdev, mask);
+		for_each_set_bit(i, &mask, ASP_NR_STRIPES)
+			mutex_unlock(&mycdev->stripes[i].lock);
+
+		if(retval <= 0)
+			break;
+		done += retval;
+		if((size_t) retval < slice)
+			break;
+		if((size_t) done < count)
+			cond_resched();
+	}
+
+	/* give back what was not written if no record follows */
+	if((size_t) done < count) {
+		s64 expected = end;
+
+		if(atomic64_try_cmpxchg(&mycdev->log.tail, &expected, pos + done))
+			end = pos + done;
+	}
+
+	/* publish in log order */
+	if(asp_mycdev_log_commit(mycdev, pos, end, entry))
+		entry = NULL;
+	iocb->ki_pos = pos;
+
+EXIT:
+	up_read(&mycdev->resizeLock);
+	kfree(entry);
+	return (done > 0)? done : retval;
+}
+
+
+/* read from device */
+/**
+ * asp_mycdev_read_iter -
+ * @iocb: kernel I/O control block, carries the file and the position
+ * @to: destination of the read, possibly made of several user segments
+ * Description:
+ 		Reads requested number of bytes from device and updates the current position
+		in the file. Devices in ASP_MODE_LOCKLESS_READ try asp_mycdev_read_lockless
+		first and only take the locks if that keeps racing with writers; locked
+		reads are served by asp_mycdev_rw_slices, one stripe unit at a time.
+ * Return: Number of bytes read from the device
+ */
+static ssize_t asp_mycdev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct asp_mycdev *mycdev = iocb->ki_filp->private_data;
+	size_t count = iov_iter_count(to);
+	u64 start = ktime_get_ns();
+	ssize_t retval = 0;
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO)
+	{
+		retval = asp_mycdev_fifo_read(mycdev, iocb, to);
+		asp_mycdev_account(mycdev, ASP_OP_READ, start, retval);
+		trace_asp_mycdev_read(mycdev->devID, iocb->ki_pos, count, retval);
+		return retval;
+	}
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_LOCKLESS_READ)
+	{
+		retval = asp_mycdev_read_lockless(mycdev, iocb->ki_pos, to);
+		if(retval != -EAGAIN)
+			goto DONE;
+	}
+
+	/* copy to user page by page, one slice at a time */
+	retval = asp_mycdev_rw_slices(mycdev, iocb, to, false);
+
+DONE:
+	asp_mycdev_account(mycdev, ASP_OP_READ, start, retval);
+	trace_asp_mycdev_read(mycdev->devID, iocb->ki_pos, count, retval);
+
+	/* update the offset in the device */
+	if(retval > 0)
+		iocb->ki_pos += retval;
+	return retval;
+}
+
+
+/* write to device */
+/**
+ * asp_mycdev_write_iter
+ * @iocb: kernel I/O control block, carries the file and the position
+ * @from: source of the write, possibly made of several user segments
+ * Description:
+ 		Writes the requested number of bytes to the device and updates the file position
+		in the device. A write which does not fit the device fails as a whole, the
+		rest is served by asp_mycdev_rw_slices one stripe unit at a time.
+ * Return: Number of bytes written to the device
+ */
+static ssize_t asp_mycdev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct asp_mycdev *mycdev = iocb->ki_filp->private_data;
+	size_t count = iov_iter_count(from);
+	u64 start = ktime_get_ns();
+	ssize_t retval = 0;
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO)
+	{
+		retval = asp_mycdev_fifo_write(mycdev, iocb, from);
+		asp_mycdev_account(mycdev, ASP_OP_WRITE, start, retval);
+		trace_asp_mycdev_write(mycdev->devID, iocb->ki_pos, count, retval);
+		return retval;
+	}
+
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_APPEND)
+	{
+		retval = (count > 0)? asp_mycdev_append(mycdev, iocb, from) : 0;
+		goto DONE;
+	}
+
+	if((count + iocb->ki_pos) > READ_ONCE(mycdev->ramdiskSize)) { /* write beyond our device size */
+		retval = -ENOMEM;
+		goto DONE;
+	}
+
+	/* copy from user page by page, one slice at a time */
+	retval = asp_mycdev_rw_slices(mycdev, iocb, from, true);
+
+DONE:
+	asp_mycdev_account(mycdev, ASP_OP_WRITE, start, retval);
+	trace_asp_mycdev_write(mycdev->devID, iocb->ki_pos, count, retval);
+	if(retval == -ENOMEM)
+		asp_dbg(mycdev, "Attempt to WRITE beyond the device size!\n");
+
+	/* update the offset in the device */
+	if(retval > 0)
+		iocb->ki_pos += retval;
+	return retval;
+}
+
+
+/* batched I/O */
+/**
+ * asp_mycdev_batch -
+ * @mycdev: device to run the batch on
+ * @uarg: struct asp_mycdev_batch in user space
+ * Description:
+ 		Runs an array of reads and writes at explicit offsets under a single
+		acquisition of the locks: the stripes covering all of them are taken once,
+		and one write section is opened for all the writes. Every operation gets
+		the result pread/pwrite would have given it, a failing one does not stop
+		the batch. Not available in FIFO mode, which has no offsets, nor in
+		ASP_MODE_APPEND, where the log is only written at its tail and only read
+		up to its committed records.
+ * Return: 0 once all results are stored, or an errno for the batch as a whole
+ */
+static long asp_mycdev_batch(struct asp_mycdev *mycdev, struct asp_mycdev_batch __user *uarg)
+{
+	struct asp_mycdev_batch batch = { 0 };
+	struct asp_mycdev_batch_op __user *uops = NULL;
+	struct asp_mycdev_batch_op *ops = NULL;
+	unsigned long mask = 0, writeMask = 0;
+	long retval = 0;
+	u32 i = 0;
+
+	if(READ_ONCE(mycdev->mode) & (ASP_MODE_FIFO | ASP_MODE_APPEND))
+		return -EINVAL;
+	if(copy_from_user(&batch, uarg, sizeof(batch)))
+		return -EFAULT;
+	if(batch.count == 0)
+		return 0;
+	if(batch.count > ASP_BATCH_MAX)
+		return -EINVAL;
+
+	uops = u64_to_user_ptr(batch.ops);
+	ops = vmemdup_user(uops, batch.count * sizeof(*ops));
+	if(IS_ERR(ops))
+		return PTR_ERR(ops);
+
+	/* validate, and collect the stripes of the whole batch */
+	for(i = 0; i < batch.count; i++)
+	{
+		struct asp_mycdev_batch_op *op = &ops[i];
+		unsigned long opMask = 0;
+
+		op->result = 0;
+		if(op->op > ASP_BATCH_WRITE || op->len > MAX_RW_COUNT || op->offset > LLONG_MAX - op->len) {
+			op->result = -EINVAL;
+			continue;
+		}
+		opMask = asp_mycdev_stripe_mask(op->offset, op->len);
+		mask |= opMask;
+		if(op->op == ASP_BATCH_WRITE)
+			writeMask |= opMask;
+	}
+
+	/* ENTER Critical Section, once for the whole batch */
+	retval = asp_mycdev_lock_range(mycdev, mask, false);
+	if(retval)
+		goto FREE;
+	if(mycdev->mode & (ASP_MODE_FIFO | ASP_MODE_APPEND)) {	/* switched meanwhile */
+		asp_mycdev_unlock_range(mycdev, mask);
+		retval = -EINVAL;
+		goto FREE;
+	}
+	asp_mycdev_write_begin(mycdev, writeMask);
+
+	for(i = 0; i < batch.count; i++)
+	{
+		struct asp_mycdev_batch_op *op = &ops[i];
+		struct iovec iov = { 0 };
+		struct iov_iter iter;
+		size_t count = op->len;
+		u64 start = ktime_get_ns();
+
+		if(op->result < 0)		/* rejected above */
+			continue;
+
+		if(op->op == ASP_BATCH_READ)
+		{
+			/* read only upto the device size */
+			count = (op->offset < mycdev->ramdiskSize)?\
+				min_t(size_t, count, mycdev->ramdiskSize - op->offset) : 0;
+			op->result = import_single_range(READ, u64_to_user_ptr(op->buf), count, &iov, &iter);
+			if(op->result == 0)
+				op->result = asp_mycdev_copy_to_iter(mycdev, op->offset, count, &iter);
+			asp_mycdev_account(mycdev, ASP_OP_READ, start, op->result);
+			trace_asp_mycdev_read(mycdev->devID, op->offset, count, op->result);
+		}
+		else
+		{
+			if(op->offset + count > mycdev->ramdiskSize)	/* write beyond our device size */
+				op->result = -ENOMEM;
+			else
+				op->result = import_single_range(WRITE, u64_to_user_ptr(op->buf), count, &iov, &iter);
+			if(op->result == 0) {
+				mycdev->devReset = false;
+				op->result = asp_mycdev_copy_from_iter(mycdev, op->offset, count, &iter);
+			}
+			asp_mycdev_account(mycdev, ASP_OP_WRITE, start, op->result);
+			trace_asp_mycdev_write(mycdev->devID, op->offset, count, op->result);
+		}
+	}
+
+	asp_mycdev_write_end(mycdev, writeMask);
+	asp_mycdev_unlock_range(mycdev, mask);			/* EXIT Critical Section */
+
+	/* hand back the results */
+	for(i = 0; i < batch.count; i++)
+	{
+		if(put_user(ops[i].result, &uops[i].result)) {
+			retval = -EFAULT;
+			break;
+		}
+	}
+
+FREE:
+	kvfree(ops);
+	return retval;
+}
+
+
+/* atomic word operations */
+/**
+ * asp_mycdev_atomic -
+ * @mycdev: device holding the word
+ * @uarg: struct asp_mycdev_atomic in user space
+ * Description:
+ 		Fetch-add, compare-exchange or exchange of an aligned 64-bit word. Only the
+		stripe of the word is locked, so the operation is atomic against read,
+		write and other ASP_ATOMIC calls, and it uses the CPU atomics so that it is
+		atomic against processes operating on a mapping of the word as well.
+		A hole reads as zero; a compare-exchange that fails on it allocates nothing.
+		Not available in FIFO mode and ASP_MODE_APPEND, whose data is not
+		addressed by offset.
+ * Return: 0 with the old value stored in uarg->old, -EINVAL, -ENOMEM or -EFAULT
+ */
+static long asp_mycdev_atomic(struct asp_mycdev *mycdev, struct asp_mycdev_atomic __user *uarg)
+{
+	struct asp_mycdev_atomic req = { 0 };
+	struct page *page = NULL;
+	unsigned long mask = 0;
+	atomic64_t *word = NULL;
+	void *kaddr = NULL;
+	long retval = 0;
+
+	if(READ_ONCE(mycdev->mode) & (ASP_MODE_FIFO | ASP_MODE_APPEND))
+		return -EINVAL;
+	if(copy_from_user(&req, uarg, sizeof(req)))
+		return -EFAULT;
+	if(req.op > ASP_ATOMIC_XCHG || !IS_ALIGNED(req.offset, sizeof(u64)) ||\
+		req.offset > LLONG_MAX - sizeof(u64))
+		return -EINVAL;
+
+	/* ENTER Critical Section, the stripe of the word only */
+	mask = asp_mycdev_stripe_mask(req.offset, sizeof(u64));
+	retval = asp_mycdev_lock_range(mycdev, mask, false);
+	if(retval)
+		return retval;
+	if(mycdev->mode & (ASP_MODE_FIFO | ASP_MODE_APPEND)) {	/* switched meanwhile */
+		retval = -EINVAL;
+		goto EXIT;
+	}
+	if(req.offset + sizeof(u64) > mycdev->ramdiskSize) {	/* beyond our device size */
+		retval = -ENOMEM;
+		goto EXIT;
+	}
+
+	page = xa_load(asp_mycdev_pages(mycdev), req.offset >> PAGE_SHIFT);
+	if(page == NULL && req.op == ASP_ATOMIC_CMPXCHG && req.expected != 0) {
+		req.old = 0;		/* the zero of the hole, the compare fails */
+		goto EXIT;
+	}
+	page = asp_mycdev_write_page(mycdev, req.offset >> PAGE_SHIFT);
+	if(page == NULL) {
+		retval = -ENOMEM;
+		goto EXIT;
+	}
+
+	mycdev->devReset = false;
+	asp_mycdev_write_begin(mycdev, mask);
+	kaddr = kmap_local_page(page);
+	word = kaddr + offset_in_page(req.offset);
+	switch(req.op)
+	{
+		case ASP_ATOMIC_FETCH_ADD:
+			req.old = atomic64_fetch_add(req.value, word);
+			break;
+		case ASP_ATOMIC_CMPXCHG:
+			req.old = atomic64_cmpxchg(word, req.expected, req.value);
+			break;
+		case ASP_ATOMIC_XCHG:
+			req.old = atomic64_xchg(word, req.value);
+			break;
+	}
+	kunmap_local(kaddr);
+	asp_mycdev_write_end(mycdev, mask);
+
+EXIT:
+	asp_mycdev_unlock_range(mycdev, mask);			/* EXIT Critical Section */
+	if(retval == 0 && put_user(req.old, &uarg->old))
+		retval = -EFAULT;
+	return retval;
+}
+
+
+/* copies between devices */
+/**
+ * asp_mycdev_lock_pair -
+ * @dst: device written by a copy
+ * @dmask: stripes of dst to lock
+ * @src: device read by the copy, may be dst
+ * @smask: stripes of src to lock
+ * Description:
+ 		Locks a range of two devices as asp_mycdev_lock_range does for one. The
+		device at the lower address is locked first, so that copies in opposite
+		directions can not deadlock, and the second as a nested instance of the
+		same lock classes. A copy within one device locks both ranges at once.
+ * Return: 0 on success, -ERESTARTSYS if interrupted while waiting for a resize or a stripe
+ */
+static int asp_mycdev_lock_pair(struct asp_mycdev *dst, unsigned long dmask,\
+	struct asp_mycdev *src, unsigned long smask)
+{
+	struct asp_mycdev *first = (src < dst)? src : dst;
+	struct asp_mycdev *second = (src < dst)? dst : src;
+	unsigned long mask = (src < dst)? dmask : smask;
+	int retval = 0;
+
+	if(src == dst)
+		return asp_mycdev_lock_range(dst, dmask | smask, false);
+
+	retval = asp_mycdev_lock_range(first, (src < dst)? smask : dmask, false);
+	if(retval)
+		return retval;
+	down_read_nested(&second->resizeLock, SINGLE_DEPTH_NESTING);
+	if(asp_mycdev_lock_stripes(second, mask, SINGLE_DEPTH_NESTING)) {
+		up_read(&second->resizeLock);
+		asp_mycdev_unlock_range(first, (src < dst)? smask : dmask);
+		return -ERESTARTSYS;
+	}
+	return 0;
+}
+
+
+/* drop the locks taken by asp_mycdev_lock_pair */
+static void asp_mycdev_unlock_pair(struct asp_mycdev *dst, unsigned long dmask,\
+	struct asp_mycdev *src, unsigned long smask)
+{
+	if(src == dst) {
+		asp_mycdev_unlock_range(dst, dmask | smask);
+		return;
+	}
+	asp_mycdev_unlock_range(dst, dmask);
+	asp_mycdev_unlock_range(src, smask);
+}
+
+
+/* true if one of nr pages from index is a subpage of a huge block, the range is locked */
+static bool asp_mycdev_range_huge(struct asp_mycdev *mycdev, unsigned long index, unsigned long nr)
+{
+	void *entry = NULL;
+
+	xa_for_each_range(asp_mycdev_pages(mycdev), index, entry, index, index + nr - 1) {
+		if(!xa_is_value(entry) && PageCompound((struct page *) entry))
+			return true;
+	}
+	return false;
+}
+
+
+/**
+ * asp_mycdev_share_pages -
+ * @dst: device to write, the range is locked by the caller
+ * @dindex: first page index in dst
+ * @src: device to read, the range is locked by the caller
+ * @sindex: first page index in src
+ * @nr: number of pages, a whole aligned huge block on both sides or a run without any
+ * @entries: room for nr entries
+ * Description:
+ 		Makes a range of dst refer to the pages of src, as asp_mycdev_share_store
+		does for a whole device: every page gets a reference for each side and is
+		marked ASP_PAGE_SHARED on both, compressed pages are duplicated and holes
+		of src punch holes into dst. The entries of src are taken first, under
+		its mapLock, then the ones of dst replaced under its own, so a copy within
+		one device never holds two of them. Mappings of the range are zapped on
+		both devices, the ones of src fault back read-only.
+ * Return: number of pages shared, -ENOMEM if none could be
+ */
+static long asp_mycdev_share_pages(struct asp_mycdev *dst, unsigned long dindex,\
+	struct asp_mycdev *src, unsigned long sindex, unsigned long nr, void **entries)
+{
+	struct asp_mycdev_store *to = NULL;
+	struct xarray *from = NULL;
+	unsigned long i = 0, done = 0;
+
+	/* faults of src wait on mapLock until the marks are set */
+	down_write(&src->mapLock);
+	from = asp_mycdev_pages(src);
+	mutex_lock(&src->allocLock);
+	for(i = 0; i < nr; i++)
+	{
+		void *entry = xa_load(from, sindex + i);
+		struct asp_mycdev_zpage *zpage = asp_mycdev_to_zpage(entry);
+
+		/* compressed pages are small, they are copied rather than shared */
+		if(zpage != NULL) {
+			zpage = kmemdup(zpage, sizeof(*zpage) + zpage->len, GFP_KERNEL_ACCOUNT);
+			if(zpage == NULL)
+				break;
+			entry = asp_mycdev_mk_zpage(zpage);
+		}
+		else if(entry != NULL && !xa_is_value(entry)) {
+			get_page(entry);
+			xa_set_mark(from, sindex + i, ASP_PAGE_SHARED);
+		}
+		entries[i] = entry;
+	}
+	mutex_unlock(&src->allocLock);
+	unmap_mapping_range(src->mapping, (loff_t) sindex << PAGE_SHIFT, (loff_t) nr << PAGE_SHIFT, 1);
+	up_write(&src->mapLock);
+
+	/* all or nothing, a huge block of dst must not be replaced in part */
+	if(i < nr) {
+		while(i--)
+			asp_mycdev_drop_entry(entries[i]);
+		return -ENOMEM;
+	}
+
+	down_write(&dst->mapLock);
+	to = asp_mycdev_store(dst);
+	mutex_lock(&dst->allocLock);
+	for(done = 0; done < nr; done++)
+	{
+		void *entry = entries[done];
+		void *old = xa_store(&to->pages, dindex + done, entry, GFP_KERNEL_ACCOUNT);
+
+		/* only filling a hole allocates, never within a huge block */
+		if(xa_is_err(old))
+			break;
+		if(entry != NULL && !xa_is_value(entry))
+			xa_set_mark(&to->pages, dindex + done, ASP_PAGE_SHARED);
+		else if(entry != NULL)
+			xa_clear_mark(&to->pages, dindex + done, ASP_PAGE_SHARED);
+
+		if(asp_mycdev_to_zpage(entry) != NULL) {
+			to->zpages++;
+			to->zbytes += asp_mycdev_to_zpage(entry)->len;
+		}
+		else if(xa_is_value(entry))
+			to->fillPages++;
+		else if(entry != NULL)
+			to->nrPages++;
+		if(asp_mycdev_to_zpage(old) != NULL) {
+			to->zpages--;
+			to->zbytes -= asp_mycdev_to_zpage(old)->len;
+		}
+		else if(xa_is_value(old))
+			to->fillPages--;
+		else if(old != NULL)
+			to->nrPages--;
+		entries[done] = old;		/* dropped once unmapped */
+	}
+	mutex_unlock(&dst->allocLock);
+	unmap_mapping_range(dst->mapping, (loff_t) dindex << PAGE_SHIFT, (loff_t) nr << PAGE_SHIFT, 1);
+	up_write(&dst->mapLock);
+
+	/* the replaced entries, then the ones which found no room */
+	for(i = 0; i < nr; i++)
+		asp_mycdev_drop_entry(entries[i]);
+	return (done > 0)? done : -ENOMEM;
+}
+
+
+/**
+ * asp_mycdev_copy_pages -
+ * @dst: device to write, the range is locked by the caller
+ * @dpos: offset in dst
+ * @src: device to read, the range is locked by the caller
+ * @spos: offset in src
+ * @count: number of bytes to copy, within the size of both devices
+ * Description:
+ 		Copies a range of one ramdisk into another page by page, without a round
+		trip through user memory. Holes of src read as zeros, they stay holes
+		where dst has a hole as well.
+ * Return: Number of bytes copied, -ENOMEM if none could be copied
+ */
+static ssize_t asp_mycdev_copy_pages(struct asp_mycdev *dst, loff_t dpos,\
+	struct asp_mycdev *src, loff_t spos, size_t count)
+{
+	ssize_t retval = 0;
+
+	while(count > 0)
+	{
+		size_t soff = offset_in_page(spos), doff = offset_in_page(dpos);
+		size_t chunk = min_t(size_t, count, PAGE_SIZE - max(soff, doff));
+		struct page *from = asp_mycdev_load_page(src, spos >> PAGE_SHIFT);
+		struct page *to = NULL;
+
+		if(IS_ERR(from))
+			return (retval > 0)? retval : PTR_ERR(from);
+		if(from != NULL || xa_load(asp_mycdev_pages(dst), dpos >> PAGE_SHIFT) != NULL)
+		{
+			/* writing dst may copy a shared block holding from, keep it alive */
+			if(from != NULL)
+				get_page(from);
+			to = asp_mycdev_write_page(dst, dpos >> PAGE_SHIFT);
+			if(to != NULL && from != NULL)
+				memcpy_page(to, doff, from, soff, chunk);
+			else if(to != NULL)
+				memzero_page(to, doff, chunk);
+			if(from != NULL)
+				put_page(from);
+			if(to == NULL)
+				return (retval > 0)? retval : -ENOMEM;
+		}
+
+		retval += chunk;
+		spos += chunk;
+		dpos += chunk;
+		count -= chunk;
+	}
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_copy_range -
+ * @filp: file of the destination device, open for writing
+ * @uarg: struct asp_mycdev_copy_range in user space
+ * Description:
+ 		Copies a range from the device open as uarg->src_fd, possibly the same one,
+		in the slices asp_mycdev_rw_slices uses, with the ranges of both devices
+		locked for each slice. With ASP_COPY_SHARE the whole pages of the range
+		are shared copy-on-write instead, a huge block is shared as a whole if it
+		lines up on both sides and copied otherwise, and a partial last page is
+		copied. The copy stops at the end of the source and is short if interrupted
+		by a fatal signal; reaching the end of the destination ends it with -ENOMEM,
+		or short if some bytes were copied already. A destination in
+		ASP_MODE_APPEND is refused, the log is only written at its tail.
+ * Return: 0 with the bytes copied stored in uarg->copied, or a negative error
+ */
+static long asp_mycdev_copy_range(struct file *filp, struct asp_mycdev_copy_range __user *uarg)
+{
+	struct asp_mycdev *dst = filp->private_data, *src = NULL;
+	struct asp_mycdev_copy_range req = { 0 };
+	unsigned long dmask = 0, smask = 0;
+	void **entries = NULL;
+	struct fd f = { 0 };
+	u64 done = 0;
+	long retval = 0;
+
+	if(READ_ONCE(dst->mode) & ASP_MODE_APPEND)
+		return -EINVAL;
+	if(copy_from_user(&req, uarg, sizeof(req)))
+		return -EFAULT;
+	if((req.flags & ~ASP_COPY_SHARE) || req.len > LLONG_MAX ||\
+		req.src_offset > LLONG_MAX - req.len || req.dst_offset > LLONG_MAX - req.len)
+		return -EINVAL;
+	if((req.flags & ASP_COPY_SHARE) && !PAGE_ALIGNED(req.src_offset | req.dst_offset))
+		return -EINVAL;
+	if(!(filp->f_mode & FMODE_WRITE))
+		return -EBADF;
+
+	f = fdget(req.src_fd);
+	if(f.file == NULL)
+		return -EBADF;
+	if(f.file->f_op != &asp_mycdev_fileops) {		/* not one of our devices */
+		retval = -EXDEV;
+		goto PUT;
+	}
+	if(!(f.file->f_mode & FMODE_READ)) {
+		retval = -EBADF;
+		goto PUT;
+	}
+	src = f.file->private_data;
+	if(src == dst && req.src_offset < req.dst_offset + req.len &&\
+		req.dst_offset < req.src_offset + req.len) {		/* overlapping */
+		retval = -EINVAL;
+		goto PUT;
+	}
+	if(req.flags & ASP_COPY_SHARE) {
+		entries = kmalloc_array(ASP_HUGE_NR, sizeof(*entries), GFP_KERNEL);
+		if(entries == NULL) {
+			retval = -ENOMEM;
+			goto PUT;
+		}
+	}
+
+	while(done < req.len)
+	{
+		loff_t spos = req.src_offset + done, dpos = req.dst_offset + done;
+		size_t slice = min_t(u64, req.len - done,\
+			ASP_IO_SLICE - max(spos & (ASP_IO_SLICE - 1), dpos & (ASP_IO_SLICE - 1)));
+		unsigned long nr = 0;
+
+		/* a huge block is shared in one go, if it lines up on both sides */
+		if(entries != NULL && IS_ALIGNED(spos | dpos, ASP_HUGE_NR << PAGE_SHIFT) &&\
+			req.len - done >= (ASP_HUGE_NR << PAGE_SHIFT))
+			slice = ASP_HUGE_NR << PAGE_SHIFT;
+		dmask = asp_mycdev_stripe_mask(dpos, slice);
+		smask = asp_mycdev_stripe_mask(spos, slice);
+
+		/* ENTER Critical Section */
+		retval = asp_mycdev_lock_pair(dst, dmask, src, smask);
+		if(retval)
+			break;
+		if(((src->mode | dst->mode) & (ASP_MODE_FIFO | ASP_MODE_RING)) ||\
+			(dst->mode & ASP_MODE_APPEND)) {	/* a stream, or a log written at its tail only */
+			retval = -EINVAL;
+			goto UNLOCK;
+		}
+		if(spos >= src->ramdiskSize)			/* end of the source */
+			goto UNLOCK;
+		slice = min_t(size_t, slice, src->ramdiskSize - spos);
+		if(entries != NULL && slice >= PAGE_SIZE)
+			slice = round_down(slice, PAGE_SIZE);		/* the partial last page is copied */
+		if((slice + dpos) > dst->ramdiskSize) {		/* write beyond our device size */
+			retval = -ENOMEM;
+			goto UNLOCK;
+		}
+
+		nr = slice >> PAGE_SHIFT;
+		dst->devReset = false;
+		asp_mycdev_write_begin(dst, dmask);
+		if(entries != NULL && PAGE_ALIGNED(slice) &&\
+			((nr == ASP_HUGE_NR && IS_ALIGNED(spos | dpos, ASP_HUGE_NR << PAGE_SHIFT)) ||\
+			(!asp_mycdev_range_huge(src, spos >> PAGE_SHIFT, nr) &&\
+			!asp_mycdev_range_huge(dst, dpos >> PAGE_SHIFT, nr))))
+		{
+			retval = asp_mycdev_share_pages(dst, dpos >> PAGE_SHIFT, src, spos >> PAGE_SHIFT, nr,\
+				entries);
+			if(retval > 0)
+				retval <<= PAGE_SHIFT;
+		}
+		else
+			retval = asp_mycdev_copy_pages(dst, dpos, src, spos, slice);
+		asp_mycdev_write_end(dst, dmask);
+
+UNLOCK:
+		asp_mycdev_unlock_pair(dst, dmask, src, smask);			/* EXIT Critical Section */
+		if(retval <= 0)
+			break;
+		done += retval;
+		if((size_t) retval < slice || fatal_signal_pending(current))
+			break;
+		cond_resched();
+	}
+	kfree(entries);
+	if(done > 0 || retval == 0)
+		retval = put_user(done, &uarg->copied)? -EFAULT : 0;
+
+PUT:
+	fdput(f);
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_seek_data -
+ * @mycdev: device to search, resizeLock is held by the caller
+ * @offset: offset to start the search at
+ * @whence: SEEK_DATA or SEEK_HOLE
+ * Description:
+ 		Finds the next allocated page, or the next hole, at or after offset. The
+		granularity is a page and the end of the device counts as a hole.
+		The hole search walks the populated run in one pass, but every page has a
+		slot of its own, so it steps over leaf nodes whose XA_CHUNK_SIZE slots are
+		all in use instead of visiting each of their pages.
+ * Return: offset found, -ENXIO if offset is beyond the end or no data follows
+ */
+static loff_t asp_mycdev_seek_data(struct asp_mycdev *mycdev, loff_t offset, int whence)
+{
+	loff_t size = mycdev->ramdiskSize;
+	unsigned long index = 0, last = 0;
+
+	if(offset < 0 || offset >= size)
+		return -ENXIO;
+	index = offset >> PAGE_SHIFT;
+	last = (size - 1) >> PAGE_SHIFT;
+
+	if(whence == SEEK_DATA)
+	{
+		if(xa_find(asp_mycdev_pages(mycdev), &index, last, XA_PRESENT) == NULL)
+			return -ENXIO;
+	}
+	else
+	{
+		XA_STATE(xas, asp_mycdev_pages(mycdev), index);
+		void *entry = NULL;
+
+		/* one walk over the populated run, the first index skipped is the hole */
+		rcu_read_lock();
+		xas_for_each(&xas, entry, last) {
+			if(xas_retry(&xas, entry))
+				continue;
+			if(xas.xa_index != index)
+				break;
+			/* a full leaf holds no hole, resume the walk after it */
+			if(xas.xa_node && !xas.xa_node->shift &&\
+				READ_ONCE(xas.xa_node->count) == XA_CHUNK_SIZE) {
+				index = (xas.xa_index | XA_CHUNK_MASK) + 1;
+				xas_set(&xas, index);
+				continue;
+			}
+			index++;
+		}
+		rcu_read_unlock();
+	}
+	return clamp_t(loff_t, (loff_t) index << PAGE_SHIFT, offset, size);
+}
+
+
+/* set the ramdisk offset to desired offset in the device */
+/**
+ * asp_mycdev_lseek -
+ * @filp: file pointer
+ * @f_offset: requested offset to be set the file
+ * @action: SEEK_SET/ SEEK_CUR/ SEEK_END/ SEEK_DATA/ SEEK_HOLE
+ * Description:
+ 		Set the current position in ramdisk to desired offset, based on action:
+		SEEK_SET: set to requested offset
+		SEEK_CUR: set to current offset + requested offset
+		SEEK_END: set to the requested offset from the end of file
+		SEEK_DATA/SEEK_HOLE: set to the next written page/hole from requested offset
+
+		This function also resizes the ramdisk in the device if the requested offset
+		is beyond the current file ramdisk size; the new range is a hole, no page
+		is allocated until it is written
+ * Return:
+ */
+loff_t asp_mycdev_lseek(struct file *filp, loff_t f_offset, int action)
+{
+	loff_t new_offset;
+	loff_t old_offset = filp->f_pos;
+	struct asp_mycdev *mycdev = filp->private_data;
+	bool exclusive = false;
+	u64 start = ktime_get_ns();
+
+	/* a FIFO has no file position */
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_FIFO)
+		return -ESPIPE;
+
+	/* ENTER Critical Section, shared unless the ramdisk has to grow */
+	if(down_read_interruptible(&mycdev->resizeLock))
+		return -ERESTARTSYS;
+	asp_mycdev_account_wait(mycdev, start);
+
+RETRY:
+	switch (action)
+	{
+		case SEEK_SET:
+			new_offset = f_offset;
+			break;
+
+		case SEEK_CUR:
+			new_offset = filp->f_pos + f_offset;
+			break;
+
+		case SEEK_END:
+			new_offset = ((mycdev->mode & ASP_MODE_APPEND)?\
+				atomic64_read(&mycdev->log.committed) : mycdev->ramdiskSize) + f_offset;
+			break;
+
+		case SEEK_DATA:
+		case SEEK_HOLE:
+			new_offset = asp_mycdev_seek_data(mycdev, f_offset, action);
+			if(new_offset < 0)
+				goto EXIT;
+			break;
+
+		default:
+			new_offset = -EINVAL;
+			goto EXIT;
+	}
+	/* validity checks (lower boundary) */
+	new_offset = (new_offset < 0)? 0: new_offset;
+
+	/* if the new_offset is beyond the current size of ramdisk, extend it;
+	nothing is allocated, the new range is a hole until it is written */
+	if(new_offset > mycdev->ramdiskSize)
+	{
+		size_t old_ramdiskSize = mycdev->ramdiskSize;
+		/* find the new ramdisk size which is multiple of PAGE_SIZE */
+		size_t new_ramdiskSize = PAGE_ALIGN(new_offset);
+
+		/* a capped device does not grow beyond its limit */
+		if(mycdev->maxSize && new_ramdiskSize > mycdev->maxSize) {
+			new_offset = -EFBIG;
+			goto EXIT;
+		}
+
+		/* growing needs the whole device, SEEK_END depends on the size
+		so the target is computed again once we hold it exclusively */
+		if(!exclusive)
+		{
+			u64 wait = ktime_get_ns();
+
+			up_read(&mycdev->resizeLock);
+			if(down_write_killable(&mycdev->resizeLock))
+				return -ERESTARTSYS;
+			asp_mycdev_account_wait(mycdev, wait);
+			exclusive = true;
+			goto RETRY;
+		}
+
+		/* publish the new size to mmap faults as well */
+		down_write(&mycdev->mapLock);
+		WRITE_ONCE(mycdev->ramdiskSize, new_ramdiskSize);
+		up_write(&mycdev->mapLock);
+
+		this_cpu_inc(mycdev->stats->resizes);
+		trace_asp_mycdev_resize(mycdev->devID, old_ramdiskSize, new_ramdiskSize, 0);
+	}
+	/* update the current seek */
+	filp->f_pos = new_offset;
+
+EXIT:
+	if(exclusive)
+		up_write(&mycdev->resizeLock);
+	else
+		up_read(&mycdev->resizeLock);
+
+	asp_mycdev_account(mycdev, ASP_OP_SEEK, start, new_offset < 0? new_offset : 0);
+	trace_asp_mycdev_seek(mycdev->devID, old_offset, f_offset, action, new_offset);
+	return new_offset;
+}
+
+
+/**
+ * asp_mycdev_set_mode -
+ * @mycdev: device to switch, resizeLock is held exclusively by the caller
+ * @mode: new ASP_MODE_* flags
+ * Description:
+ 		Entering or leaving FIFO or ring mode starts over with an empty ring, and
+		wakes up everybody sleeping on the old one.
+ * Return: 0 on success, -EINVAL for unknown or conflicting flags, -ENOMEM
+ */
+static long asp_mycdev_set_mode(struct asp_mycdev *mycdev, u32 mode)
+{
+	u32 changed = mode ^ mycdev->mode;
+	long retval = 0;
+
+	if((mode & ~ASP_MODE_MASK) ||\
+		(mode & (ASP_MODE_FIFO | ASP_MODE_RING)) == (ASP_MODE_FIFO | ASP_MODE_RING))
+		return -EINVAL;
+	if((mode & (ASP_MODE_CACHE | ASP_MODE_APPEND)) && (mode & (ASP_MODE_FIFO | ASP_MODE_RING)))
+		return -EINVAL;		/* a stream can not lose pages, nor be a log */
+	if((mode & ASP_MODE_COMPRESS) && asp_mycdev_tfms == NULL)
+		return -EOPNOTSUPP;
+
+	if(changed & mode & ASP_MODE_RING) {
+		retval = asp_mycdev_ring_reset(mycdev);
+		if(retval)
+			return retval;
+	}
+	/* before the switch, lockless readers go by the watermark right away */
+	if(changed & mode & ASP_MODE_APPEND)
+		asp_mycdev_log_reset(mycdev);
+	WRITE_ONCE(mycdev->mode, mode);
+	if(changed & (ASP_MODE_FIFO | ASP_MODE_RING))
+		asp_mycdev_fifo_reset(mycdev);
+	/* the scan stops by itself once the mode is cleared, compressed pages stay */
+	if(changed & mode & ASP_MODE_COMPRESS)
+		queue_delayed_work(asp_mycdev_wq, &mycdev->compressWork, compress_interval * HZ);
+	return 0;
+}
+
+
+/**
+ * asp_mycdev_set_limit -
+ * @mycdev: device to cap, resizeLock is held exclusively by the caller
+ * @limit: largest size lseek may grow the device to, 0 for no cap
+ * Return: 0, or -EINVAL unless limit is a page multiple not below the size
+ */
+static long asp_mycdev_set_limit(struct asp_mycdev *mycdev, u64 limit)
+{
+	if(limit != 0 && (!PAGE_ALIGNED(limit) || limit < mycdev->ramdiskSize || limit > SIZE_MAX))
+		return -EINVAL;
+	mycdev->maxSize = limit;
+	return 0;
+}
+
+
+/* IOCTL calls */
+long asp_mycdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	long retval = -1;
+	struct asp_mycdev *mycdev = NULL;
+	u64 start = ktime_get_ns();
+
+	/* Extracts type and number bitfields;
+	don't decode wrong commands; return -ENOTTY (Inappropriate IOCTL)  */
+	if(_IOC_TYPE(cmd) != ASP_MYCDEV_MAGIC)
+		return -ENOTTY;
+	if(_IOC_NR(cmd) > ASP_IOCTL_MAXNR)
+		return -ENOTTY;
+
+	/* If everything is fine, extract the command and perform action */
+	mycdev = filp->private_data;
+
+	/* batches, atomics and copies do I/O, they lock the stripes they need like read and write do */
+	if(cmd == ASP_BATCH || cmd == ASP_ATOMIC || cmd == ASP_COPY_RANGE)
+	{
+		if(cmd == ASP_BATCH)
+			retval = asp_mycdev_batch(mycdev, (struct asp_mycdev_batch __user *) arg);
+		else if(cmd == ASP_ATOMIC)
+			retval = asp_mycdev_atomic(mycdev, (struct asp_mycdev_atomic __user *) arg);
+		else
+			retval = asp_mycdev_copy_range(filp, (struct asp_mycdev_copy_range __user *) arg);
+		asp_mycdev_account(mycdev, ASP_OP_IOCTL, start, retval);
+		return retval;
+	}
+
+	/* snapshots create a device, asp_mycdev_devices_lock nests outside of our locks */
+	if(cmd == ASP_SNAPSHOT)
+	{
+		retval = asp_mycdev_snapshot(mycdev, (s32 __user *) arg);
+		asp_mycdev_account(mycdev, ASP_OP_IOCTL, start, retval);
+		return retval;
+	}
+
+	/* doorbells are the only syscalls of a busy ring, keep them off the exclusive lock */
+	if(cmd == ASP_RING_KICK)
+	{
+		if(down_read_killable(&mycdev->resizeLock))
+			return -ERESTARTSYS;
+		retval = asp_mycdev_ring_kick(mycdev, arg);
+		up_read(&mycdev->resizeLock);
+		asp_mycdev_account(mycdev, ASP_OP_IOCTL, start, retval);
+		return retval;
+	}
+
+	/* Enter Critical Section, clearing and mode changes need the whole device */
+	if(down_write_killable(&mycdev->resizeLock))
+		return -ERESTARTSYS;
+	asp_mycdev_account_wait(mycdev, start);
+
+	switch (cmd)
+	{
+		/* clear the ramdisk & seek to start of the file, optionally shrinking it */
+		case ASP_CLEAR_BUF:
+		case ASP_CLEAR_SHRINK:
+		{
+			size_t old_ramdiskSize = mycdev->ramdiskSize;
+			size_t new_ramdiskSize = (cmd == ASP_CLEAR_SHRINK)?\
+				mycdev->initialSize : old_ramdiskSize;
+
+			retval = asp_mycdev_reset_store(mycdev, new_ramdiskSize);
+			if(retval)
+				break;
+			if(new_ramdiskSize != old_ramdiskSize) {
+				this_cpu_inc(mycdev->stats->resizes);
+				trace_asp_mycdev_resize(mycdev->devID, old_ramdiskSize, new_ramdiskSize, 0);
+			}
+			if(mycdev->mode & ASP_MODE_FIFO)
+				asp_mycdev_fifo_reset(mycdev);
+			if(mycdev->mode & ASP_MODE_RING)
+				asp_mycdev_ring_reset(mycdev);		/* the header exists, can not fail */
+			if(mycdev->mode & ASP_MODE_APPEND)
+				asp_mycdev_log_reset(mycdev);
+			filp->f_pos = 0;
+			mycdev->devReset = true;
+			retval = 1;
+			break;
+		}
+
+		/* switch the device mode */
+		case ASP_SET_MODE:
+		{
+			u32 mode = 0;
+
+			if(get_user(mode, (u32 __user *) arg)) {
+				retval = -EFAULT;
+				break;
+			}
+			retval = asp_mycdev_set_mode(mycdev, mode);
+			break;
+		}
+
+		/* report the device mode */
+		case ASP_GET_MODE:
+			retval = put_user(mycdev->mode, (u32 __user *) arg);
+			break;
+
+		/* set the NUMA placement of new pages */
+		case ASP_SET_NUMA:
+		{
+			struct asp_mycdev_numa numa = { 0 };
+
+			if(copy_from_user(&numa, (void __user *) arg, sizeof(numa))) {
+				retval = -EFAULT;
+				break;
+			}
+			retval = asp_mycdev_check_numa(numa.policy, numa.node);
+			if(retval)
+				break;
+			WRITE_ONCE(mycdev->numaPolicy, numa.policy);
+			WRITE_ONCE(mycdev->numaNode, (numa.policy == ASP_NUMA_FIXED)? numa.node : NUMA_NO_NODE);
+			break;
+		}
+
+		/* report the NUMA placement */
+		case ASP_GET_NUMA:
+		{
+			struct asp_mycdev_numa numa = {
+				.policy = mycdev->numaPolicy,
+				.node = mycdev->numaNode,
+			};
+
+			retval = copy_to_user((void __user *) arg, &numa, sizeof(numa))? -EFAULT : 0;
+			break;
+		}
+
+		/* cap the growth of the device, only the administrator may lift it */
+		case ASP_SET_LIMIT:
+		{
+			u64 limit = 0;
+
+			if(!capable(CAP_SYS_ADMIN)) {
+				retval = -EPERM;
+				break;
+			}
+			if(get_user(limit, (u64 __user *) arg)) {
+				retval = -EFAULT;
+				break;
+			}
+			retval = asp_mycdev_set_limit(mycdev, limit);
+			break;
+		}
+
+		/* report the cap */
+		case ASP_GET_LIMIT:
+			retval = put_user((u64) mycdev->maxSize, (u64 __user *) arg);
+			break;
+
+		/* set the doorbell eventfds of the shared ring */
+		case ASP_RING_SET_EVENTFD:
+			retval = asp_mycdev_ring_set_eventfd(mycdev,\
+				(struct asp_mycdev_ring_eventfd __user *) arg);
+			break;
+
+		/* the control is unlikely to come here after MAXNR check above */
+		default:
+			retval = -ENOTTY;
+	}
+
+	/* Exit Critical Section */
+	up_write(&mycdev->resizeLock);
+
+	asp_mycdev_account(mycdev, ASP_OP_IOCTL, start, retval);
+
+	/* Just to debug */
+	if(retval == 1){
+		this_cpu_inc(mycdev->stats->clears);
+		trace_asp_mycdev_clear(mycdev->devID, READ_ONCE(mycdev->ramdiskSize));
+		asp_dbg(mycdev, "Successful Reset!\n");
+	}
+	return retval;
+}
+
+
+/* page fault handler for mmap */
+/**
+ * asp_mycdev_vm_fault -
+ * @vmf: fault descriptor of the faulting address
+ * Description:
+ 		Maps the ramdisk page backing the faulting offset into the process, pages
+		are inserted on demand one at a time and holes are filled on first touch,
+		read or write, as the page is shared from then on. Read faults map pages
+		read-only and the first write to them goes through asp_mycdev_page_mkwrite.
+		Write faults copy pages shared with a snapshot and hand the private page
+		back to the core, which maps it writable in the same fault, where
+		vmf_insert_page would map it read-only under write-notify and the write
+		would fault a second time. Offsets beyond the current ramdisk
+		size raise SIGBUS until the device is grown by lseek, after which the
+		same mapping faults them in normally. ASP_CLEAR_BUF zaps all mappings
+		after swapping in an empty store, so they fault in the cleared contents.
+
+		Only mapLock is taken here and never resizeLock or a stripe, so a read or
+		write whose user buffer is a mapping of the same device can not deadlock.
+ * Return: VM_FAULT_NOPAGE once the page is mapped, VM_FAULT_SIGBUS/OOM otherwise
+ */
+static vm_fault_t asp_mycdev_vm_fault(struct vm_fault *vmf)
+{
+	struct asp_mycdev *mycdev = vmf->vma->vm_private_data;
+	struct page *page = NULL;
+	vm_fault_t retval = VM_FAULT_SIGBUS;
+
+	down_read(&mycdev->mapLock);
+	if(vmf->pgoff < DIV_ROUND_UP(mycdev->ramdiskSize, PAGE_SIZE))
+	{
+		page = (vmf->flags & FAULT_FLAG_WRITE)? NULL : asp_mycdev_load_page(mycdev, vmf->pgoff);
+		if(page == NULL)
+			page = asp_mycdev_write_page(mycdev, vmf->pgoff);
+		if(IS_ERR_OR_NULL(page))
+			retval = VM_FAULT_OOM;
+		else if(vmf->flags & FAULT_FLAG_WRITE) {
+			/* a reference for the PTE, installed writable by finish_fault */
+			get_page(page);
+			vmf->page = page;
+			retval = 0;
+		}
+		else
+			retval = vmf_insert_page(vmf->vma, vmf->address, page);
+	}
+	up_read(&mycdev->mapLock);
+
+	return retval;
+}
+
+
+/**
+ * asp_mycdev_page_mkwrite -
+ * @vmf: fault descriptor of a write to a read-only mapped page
+ * Description:
+ 		Makes a mapped page writable. The core also runs it on the private page a
+		write fault returns from asp_mycdev_vm_fault, within that fault. A
+		page shared with a snapshot is copied and its mapping zapped instead, the
+		write then faults the private copy in.
+		The page lock is taken for the core, which does not lock our pages as
+		they belong to no address_space.
+ * Return: VM_FAULT_LOCKED to map the page writable, VM_FAULT_NOPAGE to retry
+ */
+static vm_fault_t asp_mycdev_page_mkwrite(struct vm_fault *vmf)
+{
+	struct asp_mycdev *mycdev = vmf->vma->vm_private_data;
+	struct xarray *pages = NULL;
+	vm_fault_t retval = VM_FAULT_NOPAGE;
+
+	down_read(&mycdev->mapLock);
+	pages = asp_mycdev_pages(mycdev);
+	if(xa_load(pages, vmf->pgoff) != vmf->page)
+		goto EXIT;		/* cleared or copied meanwhile, the PTE is gone */
+	if(xa_get_mark(pages, vmf->pgoff, ASP_PAGE_SHARED)) {
+		if(asp_mycdev_unshare_page(mycdev, vmf->pgoff) == NULL)
+			retval = VM_FAULT_OOM;
+		goto EXIT;
+	}
+	lock_page(vmf->page);
+	retval = VM_FAULT_LOCKED;
+
+EXIT:
+	up_read(&mycdev->mapLock);
+	return retval;
+}
+
+
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/**
+ * asp_mycdev_huge_fault -
+ * @vmf: fault descriptor of the faulting address
+ * @pe_size: size of the entry the core tries to install
+ * Description:
+ 		Maps a whole huge block of an ASP_MODE_HUGE device with one PMD, provided
+		the mapping covers the aligned 2 MiB around the address and its file
+		offset is aligned alike. asp_mycdev_get_unmapped_area sees to the latter.
+		Holes are filled first and write faults copy blocks shared with a snapshot,
+		everything else falls back to asp_mycdev_vm_fault.
+ * Return: VM_FAULT_NOPAGE once the PMD is installed, VM_FAULT_FALLBACK otherwise
+ */
+static vm_fault_t asp_mycdev_huge_fault(struct vm_fault *vmf, enum page_entry_size pe_size)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct asp_mycdev *mycdev = vma->vm_private_data;
+	unsigned long haddr = vmf->address & PMD_MASK;
+	pgoff_t pgoff = linear_page_index(vma, haddr);
+	struct page *page = NULL;
+	vm_fault_t retval = VM_FAULT_FALLBACK;
+
+	if(pe_size != PE_SIZE_PMD || !(READ_ONCE(mycdev->mode) & ASP_MODE_HUGE))
+		return VM_FAULT_FALLBACK;
+	if(haddr < vma->vm_start || haddr + PMD_SIZE > vma->vm_end || (pgoff & (ASP_HUGE_NR - 1)))
+		return VM_FAULT_FALLBACK;
+
+	down_read(&mycdev->mapLock);
+	if(pgoff + ASP_HUGE_NR <= DIV_ROUND_UP(mycdev->ramdiskSize, PAGE_SIZE))
+	{
+		page = (vmf->flags & FAULT_FLAG_WRITE)? NULL : asp_mycdev_load_page(mycdev, pgoff);
+		if(page == NULL)
+			page = asp_mycdev_write_page(mycdev, pgoff);
+		/* small pages, or a block filled before the device went huge */
+		if(!IS_ERR_OR_NULL(page) && PageHead(page) && compound_order(page) == ASP_HUGE_ORDER)
+			retval = vmf_insert_pfn_pmd(vmf, page_to_pfn_t(page), vmf->flags & FAULT_FLAG_WRITE);
+	}
+	up_read(&mycdev->mapLock);
+
+	return retval;
+}
+#endif /* CONFIG_TRANSPARENT_HUGEPAGE */
+
+
+/* vm operations for mappings of asp_mycdev */
+static const struct vm_operations_struct asp_mycdev_vm_ops = {
+	.fault = asp_mycdev_vm_fault,
+	.page_mkwrite = asp_mycdev_page_mkwrite,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.huge_fault = asp_mycdev_huge_fault,
+#endif
+};
+
+
+/**
+ * asp_mycdev_get_unmapped_area -
+ * @filp: file pointer
+ * @addr: address hint of mmap
+ * @len: length of the mapping
+ * @pgoff: file offset of the mapping, in pages
+ * @flags: mmap flags
+ * Description:
+ 		For ASP_MODE_HUGE devices, places mappings of at least 2 MiB so that the
+		virtual address and the file offset are aligned alike modulo PMD_SIZE,
+		which PMD mappings need. Everything else gets the default placement.
+ * Return: start address of the mapping, or an errno
+ */
+static unsigned long asp_mycdev_get_unmapped_area(struct file *filp, unsigned long addr,\
+	unsigned long len, unsigned long pgoff, unsigned long flags)
+{
+	struct asp_mycdev *mycdev = filp->private_data;
+	unsigned long padded = len + PMD_SIZE;
+	unsigned long area = 0;
+
+	if(!(READ_ONCE(mycdev->mode) & ASP_MODE_HUGE) || addr || (flags & MAP_FIXED) ||\
+		len < PMD_SIZE || padded < len)
+		return current->mm->get_unmapped_area(filp, addr, len, pgoff, flags);
+
+	/* ask for 2 MiB more and move the start up to the alignment we need */
+	area = current->mm->get_unmapped_area(filp, 0, padded, 0, flags);
+	if(IS_ERR_VALUE(area))
+		return current->mm->get_unmapped_area(filp, addr, len, pgoff, flags);
+	return area + (((pgoff << PAGE_SHIFT) - area) & (PMD_SIZE - 1));
+}
+
+
+/* map the device into user space */
+/**
+ * asp_mycdev_mmap -
+ * @filp: file pointer
+ * @vma: the new mapping
+ * Description:
+ 		Sets up a shared mapping of the ramdisk, no page is touched here, they are
+		all faulted in by asp_mycdev_vm_fault. Private mappings are refused as the
+		device pages would have to be copied on write. ASP_RING_HEADER_OFFSET maps
+		the header of the shared ring instead.
+ * Return: 0 on success, -EINVAL for private or bad mappings
+ */
+static int asp_mycdev_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+	struct asp_mycdev *mycdev = filp->private_data;
+
+	if(!(vma->vm_flags & VM_SHARED))
+		return -EINVAL;
+	if(vma->vm_pgoff == (ASP_RING_HEADER_OFFSET >> PAGE_SHIFT))
+		return asp_mycdev_ring_mmap(mycdev, vma);
+	if(vma->vm_pgoff + vma_pages(vma) > (ASP_RING_HEADER_OFFSET >> PAGE_SHIFT))
+		return -EINVAL;
+
+	vma->vm_flags |= VM_MIXEDMAP | VM_DONTEXPAND | VM_DONTDUMP;
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_HUGE)
+		vma->vm_flags |= VM_HUGEPAGE;		/* PMD faults with THP in madvise mode too */
+	vma->vm_ops = &asp_mycdev_vm_ops;
+	vma->vm_private_data = mycdev;
+	return 0;
+}
+
+
+/* fileops for asp_mycdev */
+static struct file_operations asp_mycdev_fileops = {
+	.owner  = THIS_MODULE,
+	.open   = asp_mycdev_open,
+	.read_iter = asp_mycdev_read_iter,
+	.llseek = asp_mycdev_lseek,
+	.write_iter = asp_mycdev_write_iter,
+	.mmap   = asp_mycdev_mmap,
+	.get_unmapped_area = asp_mycdev_get_unmapped_area,
+	.poll   = asp_mycdev_poll,
+	/* both go through read_iter/write_iter. On the way out copy_page_to_iter
+	hands the ramdisk pages to the pipe by reference, so sendfile copies
+	nothing, and like page cache pages, writes made before the pipe is
+	drained show through */
+	.splice_read = generic_file_splice_read,
+	.splice_write = iter_file_splice_write,
+	.release = asp_mycdev_release,
+	.unlocked_ioctl = asp_mycdev_ioctl,
+};
+
+
+/* sysfs statistics, /sys/class/asp_mycdev_class/mycdevN/stats/ */
+/* a counter of struct asp_mycdev_stats, exported as one file */
+struct asp_mycdev_stat_attr
+{
+	struct device_attribute attr;
+	size_t offset; /* of the u64 counter in struct asp_mycdev_stats */
+};
+
+/**
+ * asp_mycdev_stat_sum -
+ * @mycdev: device to report
+ * @offset: offset of a u64 counter in struct asp_mycdev_stats
+ * Return: the counter summed over all CPUs
+ */
+static u64 asp_mycdev_stat_sum(struct asp_mycdev *mycdev, size_t offset)
+{
+	u64 sum = 0;
+	int cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		sum += *(u64 *)((char *) per_cpu_ptr(mycdev->stats, cpu) + offset);
+	return sum;
+}
+
+static ssize_t asp_mycdev_stat_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct asp_mycdev_stat_attr *sattr = container_of(attr, struct asp_mycdev_stat_attr, attr);
+
+	return sysfs_emit(buf, "%llu\n", asp_mycdev_stat_sum(dev_get_drvdata(dev), sattr->offset));
+}
+
+#define ASP_STAT_ATTR(_name, _field)	\
+	static struct asp_mycdev_stat_attr asp_stat_attr_##_name = {	\
+		.attr = __ATTR(_name, S_IRUGO, asp_mycdev_stat_show, NULL),	\
+		.offset = offsetof(struct asp_mycdev_stats, _field),	\
+	}
+
+ASP_STAT_ATTR(read_ops, ops[ASP_OP_READ]);
+ASP_STAT_ATTR(write_ops, ops[ASP_OP_WRITE]);
+ASP_STAT_ATTR(seek_ops, ops[ASP_OP_SEEK]);
+ASP_STAT_ATTR(ioctl_ops, ops[ASP_OP_IOCTL]);
+ASP_STAT_ATTR(read_bytes, bytes[ASP_OP_READ]);
+ASP_STAT_ATTR(write_bytes, bytes[ASP_OP_WRITE]);
+ASP_STAT_ATTR(resizes, resizes);
+ASP_STAT_ATTR(clears, clears);
+ASP_STAT_ATTR(errors, errors);
+ASP_STAT_ATTR(numa_misses, numaMisses);
+ASP_STAT_ATTR(huge_pages, hugePages);
+ASP_STAT_ATTR(huge_fallbacks, hugeFallbacks);
+ASP_STAT_ATTR(cow_copies, cowCopies);
+ASP_STAT_ATTR(zero_pages, zeroPages);
+ASP_STAT_ATTR(reclaimed_pages, reclaimedPages);
+
+/* histograms, one line per histogram with ASP_HIST_BUCKETS counts each */
+static ssize_t latency_hist_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	static const char * const opNames[ASP_NR_OPS] = { "read", "write", "seek", "ioctl" };
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	int len = 0, op = 0, bucket = 0;
+
+	for(op = 0; op < ASP_NR_OPS; op++)
+	{
+		len += sysfs_emit_at(buf, len, "%s", opNames[op]);
+		for(bucket = 0; bucket < ASP_HIST_BUCKETS; bucket++)
+			len += sysfs_emit_at(buf, len, " %llu", asp_mycdev_stat_sum(mycdev,\
+				offsetof(struct asp_mycdev_stats, latency[op][bucket])));
+		len += sysfs_emit_at(buf, len, "\n");
+	}
+	return len;
+}
+static DEVICE_ATTR_RO(latency_hist);
+
+static ssize_t lock_wait_hist_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	int len = 0, bucket = 0;
+
+	for(bucket = 0; bucket < ASP_HIST_BUCKETS; bucket++)
+		len += sysfs_emit_at(buf, len, "%s%llu", bucket? " " : "", asp_mycdev_stat_sum(mycdev,\
+			offsetof(struct asp_mycdev_stats, lockWait[bucket])));
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+static DEVICE_ATTR_RO(lock_wait_hist);
+
+static ssize_t decompress_hist_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	int len = 0, bucket = 0;
+
+	for(bucket = 0; bucket < ASP_HIST_BUCKETS; bucket++)
+		len += sysfs_emit_at(buf, len, "%s%llu", bucket? " " : "", asp_mycdev_stat_sum(mycdev,\
+			offsetof(struct asp_mycdev_stats, decompressLatency[bucket])));
+	len += sysfs_emit_at(buf, len, "\n");
+	return len;
+}
+static DEVICE_ATTR_RO(decompress_hist);
+
+/* contents of ASP_MODE_COMPRESS: compressed and same-filled pages, the memory
+the compressed ones take and their compression ratio */
+static ssize_t compression_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	struct asp_mycdev_store *store = NULL;
+	unsigned long zpages = 0, zbytes = 0, fillPages = 0;
+	u64 ratio = 0;
+
+	if(down_read_interruptible(&mycdev->resizeLock))
+		return -ERESTARTSYS;
+	store = asp_mycdev_store(mycdev);
+	zpages = READ_ONCE(store->zpages);
+	zbytes = READ_ONCE(store->zbytes);
+	fillPages = READ_ONCE(store->fillPages);
+	up_read(&mycdev->resizeLock);
+
+	if(zbytes != 0)
+		ratio = div64_u64((u64) zpages * PAGE_SIZE * 100, zbytes);
+	return sysfs_emit(buf, "compressed_pages %lu\ncompressed_bytes %lu\nsame_filled_pages %lu\n"\
+		"ratio %llu.%02llu\n", zpages, zbytes, fillPages, ratio / 100, ratio % 100);
+}
+static DEVICE_ATTR_RO(compression);
+
+/* placement of the device: the policy, then "node<N> <pages>" for every online node */
+static ssize_t numa_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+	static const char * const policyNames[] = { "local", "fixed", "interleave" };
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	unsigned long *pages = kcalloc(nr_node_ids, sizeof(*pages), GFP_KERNEL);
+	struct page *page = NULL;
+	unsigned long index = 0;
+	int len = 0, node = 0;
+
+	if(pages == NULL)
+		return -ENOMEM;
+	if(down_read_interruptible(&mycdev->resizeLock)) {
+		kfree(pages);
+		return -ERESTARTSYS;
+	}
+	xa_for_each(asp_mycdev_pages(mycdev), index, page) {
+		if(!xa_is_value(page))		/* compressed entries are in slab memory */
+			pages[page_to_nid(page)]++;
+		cond_resched();
+	}
+	len = sysfs_emit(buf, "policy %s", policyNames[mycdev->numaPolicy]);
+	if(mycdev->numaPolicy == ASP_NUMA_FIXED)
+		len += sysfs_emit_at(buf, len, " %d", mycdev->numaNode);
+	len += sysfs_emit_at(buf, len, "\n");
+	up_read(&mycdev->resizeLock);
+
+	for_each_online_node(node)
+		len += sysfs_emit_at(buf, len, "node%d %lu\n", node, pages[node]);
+	kfree(pages);
+	return len;
+}
+static DEVICE_ATTR_RO(numa);
+
+/* writing anything to reset zeroes all counters of the device */
+static ssize_t reset_store(struct device *dev, struct device_attribute *attr,\
+	const char *buf, size_t count)
+{
+	struct asp_mycdev *mycdev = dev_get_drvdata(dev);
+	int cpu = 0;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(mycdev->stats, cpu), 0, sizeof(struct asp_mycdev_stats));
+	return count;
+}
+static DEVICE_ATTR_WO(reset);
+
+static struct attribute *asp_mycdev_stats_attrs[] = {
+	&asp_stat_attr_read_ops.attr.attr,
+	&asp_stat_attr_write_ops.attr.attr,
+	&asp_stat_attr_seek_ops.attr.attr,
+	&asp_stat_attr_ioctl_ops.attr.attr,
+	&asp_stat_attr_read_bytes.attr.attr,
+	&asp_stat_attr_write_bytes.attr.attr,
+	&asp_stat_attr_resizes.attr.attr,
+	&asp_stat_attr_clears.attr.attr,
+	&asp_stat_attr_errors.attr.attr,
+	&asp_stat_attr_numa_misses.attr.attr,
+	&asp_stat_attr_huge_pages.attr.attr,
+	&asp_stat_attr_huge_fallbacks.attr.attr,
+	&asp_stat_attr_cow_copies.attr.attr,
+	&asp_stat_attr_zero_pages.attr.attr,
+	&asp_stat_attr_reclaimed_pages.attr.attr,
+	&dev_attr_latency_hist.attr,
+	&dev_attr_lock_wait_hist.attr,
+	&dev_attr_decompress_hist.attr,
+	&dev_attr_compression.attr,
+	&dev_attr_numa.attr,
+	&dev_attr_reset.attr,
+	NULL,
+};
+
+static const struct attribute_group asp_mycdev_stats_group = {
+	.name = "stats",
+	.attrs = asp_mycdev_stats_attrs,
+};
+
+static const struct attribute_group *asp_mycdev_groups[] = {
+	&asp_mycdev_stats_group,
+	NULL,
+};
+
+
+/* ASP_MODE_COMPRESS */
+/**
+ * asp_mycdev_free_tfms -
+ * @tfms: per-CPU transforms from asp_mycdev_alloc_tfms, possibly partially allocated
+ */
+static void asp_mycdev_free_tfms(struct crypto_comp * __percpu *tfms)
+{
+	int cpu = 0;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = *per_cpu_ptr(tfms, cpu);
+
+		if(!IS_ERR_OR_NULL(tfm))
+			crypto_free_comp(tfm);
+	}
+	free_percpu(tfms);
+}
+
+
+/**
+ * asp_mycdev_alloc_tfms -
+ * Description:
+ 		Allocates a transform of the compressor algorithm for every possible CPU,
+		they are used with preemption disabled and hold the algorithm's workspace
+ * Return: the per-CPU transforms, or NULL if the algorithm is not available
+ */
+static struct crypto_comp * __percpu *asp_mycdev_alloc_tfms(void)
+{
+	struct crypto_comp * __percpu *tfms = NULL;
+	int cpu = 0;
+
+	if(!crypto_has_comp(compressor, 0, 0))
+		return NULL;
+	tfms = alloc_percpu(struct crypto_comp *);
+	if(tfms == NULL)
+		return NULL;
+
+	for_each_possible_cpu(cpu) {
+		struct crypto_comp *tfm = crypto_alloc_comp(compressor, 0, 0);
+
+		if(IS_ERR(tfm)) {
+			asp_mycdev_free_tfms(tfms);
+			return NULL;
+		}
+		*per_cpu_ptr(tfms, cpu) = tfm;
+	}
+	return tfms;
+}
+
+
+/**
+ * asp_mycdev_compress_page -
+ * @mycdev: device in ASP_MODE_COMPRESS, locked against any use of page by the caller
+ * @index: page index in the ramdisk
+ * @page: idle small page stored at index, neither mapped nor shared
+ * @buf: scratch buffer of 2 * PAGE_SIZE
+ * Description:
+ 		Replaces the page by a hole if it is zero filled, by a value entry if it is
+		filled with another byte, or else by its compressed copy if that saves a
+		quarter of the page at least. Incompressible pages are left alone.
+ */
+static void asp_mycdev_compress_page(struct asp_mycdev *mycdev, unsigned long index,\
+	struct page *page, u8 *buf)
+{
+	struct asp_mycdev_store *store = asp_mycdev_store(mycdev);
+	struct asp_mycdev_zpage *zpage = NULL;
+	unsigned int len = 2 * PAGE_SIZE;
+	void *entry = NULL;
+	bool same = false;
+	u8 *kaddr = NULL;
+	u8 fill = 0;
+	int retval = 0;
+
+	kaddr = kmap_local_page(page);
+	fill = kaddr[0];
+	same = (memchr_inv(kaddr, fill, PAGE_SIZE) == NULL);
+	if(!same) {
+		retval = crypto_comp_compress(*get_cpu_ptr(asp_mycdev_tfms), kaddr, PAGE_SIZE, buf, &len);
+		put_cpu_ptr(asp_mycdev_tfms);
+	}
+	kunmap_local(kaddr);
+
+	if(same)
+		entry = fill? asp_mycdev_mk_fill(fill) : NULL;
+	else if(retval == 0 && len <= ASP_ZPAGE_MAX)
+	{
+		zpage = kmalloc(sizeof(*zpage) + len, GFP_KERNEL_ACCOUNT | __GFP_NOWARN);
+		if(zpage == NULL)
+			return;
+		zpage->len = len;
+		memcpy(zpage->data, buf, len);
+		entry = asp_mycdev_mk_zpage(zpage);
+	}
+	else
+		return;
+
+	xa_store(&store->pages, index, entry, GFP_KERNEL);		/* replaces or erases, allocates nothing */
+	put_page(page);
+	store->nrPages--;
+	if(zpage != NULL) {
+		store->zpages++;
+		store->zbytes += len;
+	}
+	else if(entry != NULL)
+		store->fillPages++;
+	else
+		this_cpu_inc(mycdev->stats->zeroPages);
+}
+
+
+/**
+ * asp_mycdev_compress_work -
+ * @work: compressWork of a device
+ * Description:
+ 		Compresses the pages which were not accessed since the previous scan, and
+		clears the accessed flag of the others. One stripe unit is done at a time
+		with its stripe, mapLock and allocLock held, so that neither I/O nor
+		faults can use its pages meanwhile; units without pages are skipped.
+		Mapped pages, pages shared with a snapshot and huge pages stay as they are.
+		Repeats every compress_interval seconds while ASP_MODE_COMPRESS is set.
+ */
+static void asp_mycdev_compress_work(struct work_struct *work)
+{
+	struct asp_mycdev *mycdev = container_of(to_delayed_work(work), struct asp_mycdev, compressWork);
+	u8 *buf = kmalloc(2 * PAGE_SIZE, GFP_KERNEL);
+	unsigned long next = 0;
+
+	while(buf != NULL && (READ_ONCE(mycdev->mode) & ASP_MODE_COMPRESS))
+	{
+		unsigned long mask = asp_mycdev_stripe_mask((loff_t) next << PAGE_SHIFT, 1);
+		unsigned long last = round_up(next + 1, 1UL << (ASP_STRIPE_SHIFT - PAGE_SHIFT)) - 1;
+		unsigned long index = 0;
+		struct xarray *pages = NULL;
+		struct page *page = NULL;
+
+		if(asp_mycdev_lock_range(mycdev, mask, false))
+			break;
+		down_write(&mycdev->mapLock);
+		mutex_lock(&mycdev->allocLock);
+
+		pages = asp_mycdev_pages(mycdev);
+		xa_for_each_range(pages, index, page, next, last)
+		{
+			if(xa_is_value(page) || PageCompound(page) || page_mapped(page) ||\
+				xa_get_mark(pages, index, ASP_PAGE_SHARED))
+				continue;
+			if(TestClearPageReferenced(page))		/* used since the last scan */
+				continue;
+			asp_mycdev_compress_page(mycdev, index, page, buf);
+		}
+		next = last + 1;
+		page = xa_find(pages, &next, ULONG_MAX, XA_PRESENT);
 
+		mutex_unlock(&mycdev->allocLock);
+		up_write(&mycdev->mapLock);
+		asp_mycdev_unlock_range(mycdev, mask);
+		if(page == NULL || last == ULONG_MAX)
+			break;
+		cond_resched();
+	}
+	kfree(buf);
 
-/* Other global variables */
-static struct class *asp_mycdev_class = NULL;
-static struct asp_mycdev *mycdev_devices = NULL;
-static int lastSuccessfulRamdisk = -1;
-static int lastSuccessfulCdev = -1;
-static int lastSuccessfulNode = -1;
+	if(READ_ONCE(mycdev->mode) & ASP_MODE_COMPRESS)
+		queue_delayed_work(asp_mycdev_wq, &mycdev->compressWork, compress_interval * HZ);
+}
 
-/* Function declarations */
-static int mycdev_init_module(void);
-static void mycdev_cleanup_module(void);
-static int asp_mycdev_open(struct inode *, struct file *);
-static int asp_mycdev_release(struct inode *, struct file *);
-static ssize_t asp_mycdev_read(struct file *, char __user *, size_t, loff_t *);
-static ssize_t asp_mycdev_write(struct file *, const char __user *, size_t, loff_t *);
-static loff_t asp_mycdev_lseek(struct file *, loff_t, int);
-static long asp_mycdev_ioctl(struct file *, unsigned int, unsigned long);
 
-/* Function definitions */
-/* open function */
+/* ASP_MODE_CACHE */
 /**
- * asp_mycdev_open -
- * @i_ptr: pointer to current inode being pointed after open sys call
- * @filp:	pointer to current file descriptor struct after open sys call
+ * asp_mycdev_reclaim -
+ * @mycdev: device in ASP_MODE_CACHE
+ * @budget: pages left to scan, lowered by the pages looked at
  * Description:
- 		Extracts the custom device struct from current cdev, and stores it in file's
-		private_data field
- * Return: 0, Always succeeds
+ 		Drops pages of a cache device for the shrinker, going on where the previous
+		call stopped, up to the end of the device: no page is looked at twice in
+		one call. One stripe unit is done at a time with its stripe, mapLock and
+		allocLock held as in asp_mycdev_compress_work, but as reclaim may run below
+		an allocation of this very driver, the locks are only tried and a busy
+		unit is skipped. Pages accessed since the previous pass get another round;
+		mapped, shared and huge pages are kept.
+		The caller holds asp_mycdev_devices_lock, which keeps the device alive.
+ * Return: number of pages freed
  */
-static int asp_mycdev_open(struct inode *i_ptr, struct file *filp)
+static unsigned long asp_mycdev_reclaim(struct asp_mycdev *mycdev, unsigned long *budget)
+{
+	unsigned long next = mycdev->reclaimNext, freed = 0;
+
+	while(*budget > 0)
+	{
+		unsigned long mask = asp_mycdev_stripe_mask((loff_t) next << PAGE_SHIFT, 1);
+		unsigned long last = round_up(next + 1, 1UL << (ASP_STRIPE_SHIFT - PAGE_SHIFT)) - 1;
+		unsigned long index = 0, scanned = 0;
+		struct asp_mycdev_store *store = NULL;
+		struct page *page = NULL;
+
+		cond_resched();
+		if(asp_mycdev_lock_range(mycdev, mask, true)) {
+			scanned = last + 1 - next;		/* busy, counts as looked at */
+			next = last + 1;
+			goto NEXT;
+		}
+		if(!down_write_trylock(&mycdev->mapLock)) {
+			asp_mycdev_unlock_range(mycdev, mask);
+			scanned = last + 1 - next;
+			next = last + 1;
+			goto NEXT;
+		}
+		if(!mutex_trylock(&mycdev->allocLock)) {
+			up_write(&mycdev->mapLock);
+			asp_mycdev_unlock_range(mycdev, mask);
+			scanned = last + 1 - next;
+			next = last + 1;
+			goto NEXT;
+		}
+
+		store = asp_mycdev_store(mycdev);
+		asp_mycdev_write_begin(mycdev, mask);
+		xa_for_each_range(&store->pages, index, page, next, last)
+		{
+			scanned++;
+			if(xa_is_value(page) || PageCompound(page) || page_mapped(page) ||\
+				xa_get_mark(&store->pages, index, ASP_PAGE_SHARED))
+				continue;
+			if(TestClearPageReferenced(page))		/* used since the last scan */
+				continue;
+			xa_erase(&store->pages, index);
+			put_page(page);
+			store->nrPages--;
+			freed++;
+		}
+		asp_mycdev_write_end(mycdev, mask);
+		/* skip the holes, no unit left with pages wraps around */
+		next = last + 1;
+		if(xa_find(&store->pages, &next, ULONG_MAX, XA_PRESENT) == NULL)
+			next = mycdev->ramdiskSize >> PAGE_SHIFT;
+
+		mutex_unlock(&mycdev->allocLock);
+		up_write(&mycdev->mapLock);
+		asp_mycdev_unlock_range(mycdev, mask);
+
+NEXT:
+		*budget -= min(*budget, max(scanned, 1UL));
+		if(((loff_t) next << PAGE_SHIFT) >= READ_ONCE(mycdev->ramdiskSize)) {
+			next = 0;		/* the next call starts over */
+			break;
+		}
+	}
+	mycdev->reclaimNext = next;
+	if(freed > 0)
+		this_cpu_add(mycdev->stats->reclaimedPages, freed);
+	return freed;
+}
+
+
+/* pages of the cache devices, which the shrinker may be able to drop */
+static unsigned long asp_mycdev_shrink_count(struct shrinker *shrinker, struct shrink_control *sc)
 {
 	struct asp_mycdev *mycdev = NULL;
+	unsigned long index = 0, count = 0;
 
-	/* Get the struct of current device */
-	mycdev = container_of(i_ptr->i_cdev, struct asp_mycdev, cdev);
+	/* creation allocates under it, never wait for it in reclaim */
+	if(!mutex_trylock(&asp_mycdev_devices_lock))
+		return 0;
+	rcu_read_lock();
+	xa_for_each(&asp_mycdev_devices, index, mycdev) {
+		if(READ_ONCE(mycdev->mode) & ASP_MODE_CACHE)
+			count += READ_ONCE(rcu_dereference(mycdev->store)->nrPages);
+	}
+	rcu_read_unlock();
+	mutex_unlock(&asp_mycdev_devices_lock);
+	return count;
+}
 
-	/* Make device ready for future use */
-	mycdev->devReset = false;
-	filp->private_data = mycdev;		/* for later use by other functions */
 
-	printk(KERN_INFO "%s: device %s%d opened [Major: %d, Minor: %d]\n",\
-	 	MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, imajor(i_ptr), iminor(i_ptr));
-	return 0;
+/* drop up to sc->nr_to_scan pages of the cache devices */
+static unsigned long asp_mycdev_shrink_scan(struct shrinker *shrinker, struct shrink_control *sc)
+{
+	struct asp_mycdev *mycdev = NULL;
+	unsigned long index = 0, freed = 0, budget = sc->nr_to_scan;
+
+	if(!mutex_trylock(&asp_mycdev_devices_lock))
+		return SHRINK_STOP;
+	xa_for_each(&asp_mycdev_devices, index, mycdev) {
+		if(budget == 0)
+			break;
+		if(READ_ONCE(mycdev->mode) & ASP_MODE_CACHE)
+			freed += asp_mycdev_reclaim(mycdev, &budget);
+	}
+	mutex_unlock(&asp_mycdev_devices_lock);
+	return freed? freed : SHRINK_STOP;
 }
 
 
-/* release function */
+static struct shrinker asp_mycdev_shrinker = {
+	.count_objects = asp_mycdev_shrink_count,
+	.scan_objects = asp_mycdev_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+
+/* Device lifetime */
 /**
- * asp_mycdev_release -
- * @i_ptr: current inode being referred to`
- * @filp: file descriptor pointer
- * Description: Releases the device
- * Return: 0, Always succeeds
+ * asp_mycdev_dev_release -
+ * @dev: embedded device of an asp_mycdev
+ * Description:
+ 		Frees a device once its last reference is gone. The reference of the
+		control device or of module exit is dropped by asp_mycdev_destroy, and
+		every open file holds one too, as the cdev is a child of the device.
+		Also called for a device whose creation failed half way.
  */
-static int asp_mycdev_release(struct inode *i_ptr, struct file *filp)
+static void asp_mycdev_dev_release(struct device *dev)
 {
-	struct asp_mycdev *mycdev = filp->private_data;
+	struct asp_mycdev *mycdev = container_of(dev, struct asp_mycdev, dev);
 
-	printk(KERN_INFO "%s: device %s%d closed\n",\
-	 	MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID);
-	return 0;
+	cancel_delayed_work_sync(&mycdev->compressWork);
+	asp_mycdev_free_pages(mycdev);
+	asp_mycdev_ring_free(mycdev);
+	if(mycdev->mapping != NULL)
+		iput(mycdev->mapping->host);
+	free_percpu(mycdev->stats);
+	kfree(mycdev);
 }
 
 
-/* read from device */
 /**
- * asp_mycdev_read -
- * @filp: file pointer
- * @buf: buffer handle provided from userspace
- * @count: bytes requested to read and store in buf
- * @f_offset: current position in the file
+ * asp_mycdev_create -
+ * @id: device number to use, or -1 for the first free one
+ * @size: ramdisk size in bytes
+ * @mode: ASP_MODE_* flags of the new device
+ * @source: device to take a snapshot of, or NULL
  * Description:
- 		Reads requested number of bytes from device and updates the current position
-		in the file
- * Return: Number of bytes read from the device
+ 		Allocates, initializes and registers one device. Only the device struct,
+		an empty page store and the statistics are allocated, the ramdisk itself
+		is sparse. A snapshot shares the pages of source, and takes its size and
+		placement. The device goes live as /dev/mycdev<id>.
+		The caller holds asp_mycdev_devices_lock.
+ * Return: device number on success, errno otherwise
  */
-static ssize_t asp_mycdev_read(struct file *filp, char __user *buf, size_t count,\
-	 loff_t *f_offset)
+static int asp_mycdev_create(int id, size_t size, u32 mode, struct asp_mycdev *source)
 {
-	struct asp_mycdev *mycdev = filp->private_data;
-	ssize_t retval = 0;
+	struct asp_mycdev *mycdev = kzalloc(sizeof(*mycdev), GFP_KERNEL);
+	struct inode *inode = NULL;
+	u32 devID = 0;
+	int retval = 0, j = 0;
 
-	if(mutex_lock_interruptible(&mycdev->lock))		/* ENTER Critical Section */
-		return -ERESTARTSYS;
-	if(*f_offset > mycdev->ramdiskSize)			/* already done */
-		goto EXIT;
-	if((count + *f_offset) > mycdev->ramdiskSize) { /* read beyond our device size */
-		printk(KERN_WARNING "%s: device %s%d: Attempt to READ beyond the device size!\n",\
-			MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID);
-			/* read only upte the device size */
-			count = mycdev->ramdiskSize - *f_offset;
+	if(mycdev == NULL)
+		return -ENOMEM;
+	/* from here on the release callback cleans up */
+	device_initialize(&mycdev->dev);
+	mycdev->dev.release = asp_mycdev_dev_release;
+	INIT_DELAYED_WORK(&mycdev->compressWork, asp_mycdev_compress_work);
+
+	/* a device does not start out larger than it could grow */
+	if(source == NULL && max_size_in_bytes && size > max_size_in_bytes) {
+		retval = -EFBIG;
+		goto PUT;
 	}
 
-	/* copy to user and update the offset in the device */
-	retval = count - copy_to_user(buf, (mycdev->ramdisk + *f_offset), count);
-	*f_offset += retval;
+	/* Reserve the device number */
+	if(id < 0)
+		retval = xa_alloc(&asp_mycdev_devices, &devID, NULL,\
+			XA_LIMIT(0, ASP_MAX_DEVICES - 1), GFP_KERNEL);
+	else if(id < ASP_MAX_DEVICES) {
+		devID = id;
+		retval = xa_insert(&asp_mycdev_devices, devID, NULL, GFP_KERNEL);
+	}
+	else
+		retval = -EINVAL;
+	if(retval)
+		goto PUT;
 
-	printk(KERN_DEBUG "%s: device %s%d: bytes read: %d, current position: %d\n",\
-		MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, (int)retval, (int)*f_offset);
+	/* Device Reset flag */
+	mycdev->devReset = true;
+	/* Device number */
+	mycdev->devID = devID;
+	/* Initializing Locks */
+	init_rwsem(&mycdev->resizeLock);
+	seqcount_init(&mycdev->resizeSeq);
+	for(j = 0; j < ASP_NR_STRIPES; j++) {
+		mutex_init(&mycdev->stripes[j].lock);
+		lockdep_set_class(&mycdev->stripes[j].lock, &asp_mycdev_stripe_keys[j]);
+		seqcount_init(&mycdev->stripes[j].seq);
+	}
+	init_rwsem(&mycdev->mapLock);
+	mutex_init(&mycdev->allocLock);
+	mutex_init(&mycdev->fifo.lock);
+	init_waitqueue_head(&mycdev->fifo.readq);
+	init_waitqueue_head(&mycdev->fifo.writeq);
+	spin_lock_init(&mycdev->log.lock);
+	INIT_LIST_HEAD(&mycdev->log.done);
 
-EXIT:
-	mutex_unlock(&mycdev->lock);			/* EXIT Critical Section */
-	return retval;
-}
+	/* Initializing ramdisk, sparse: pages are allocated on first write */
+	RCU_INIT_POINTER(mycdev->store, asp_mycdev_store_alloc());
+	if(rcu_access_pointer(mycdev->store) == NULL) {
+		retval = -ENOMEM;
+		goto FAIL;
+	}
+	mycdev->ramdiskSize = size;
+	mycdev->initialSize = size;
+	mycdev->maxSize = max_size_in_bytes;
 
+	/* Initializing the address_space shared by all mappings */
+	inode = alloc_anon_inode(asp_mycdev_mnt->mnt_sb);
+	if(IS_ERR(inode)) {
+		retval = PTR_ERR(inode);
+		goto FAIL;
+	}
+	mycdev->mapping = inode->i_mapping;
 
-/* write to device */
-/**
- * asp_mycdev_write
- * @filp: file pointer
- * @buf: buffer handle provided from userspace
- * @count: bytes requested to write from buffer
- * @f_offset: current position in the file
- * Description:
- 		Writes the requested number of bytes to the device and updates the file position
-		in the device
- * Return: Number of bytes written to the device
- */
-static ssize_t asp_mycdev_write(struct file *filp, const char __user *buf, \
-	size_t count, loff_t *f_offset)
-{
-	struct asp_mycdev *mycdev = filp->private_data;
-	ssize_t retval = -ENOMEM;
+	/* Initializing statistics */
+	mycdev->stats = alloc_percpu(struct asp_mycdev_stats);
+	if(mycdev->stats == NULL) {
+		retval = -ENOMEM;
+		goto FAIL;
+	}
 
-	if(mutex_lock_interruptible(&mycdev->lock))		/* ENTER Critical Section */
-		return -ERESTARTSYS;
-	if((count + *f_offset) > mycdev->ramdiskSize) { /* write beyond our device size */
-		printk(KERN_WARNING "%s: device %s%d: Attempt to WRITE beyond the device size! Returning!\n",\
-			MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID);
-		goto EXIT;
+	retval = asp_mycdev_set_mode(mycdev, mode);
+	if(retval)
+		goto FAIL;
+	mycdev->numaPolicy = numa_policy;
+	mycdev->numaNode = (numa_policy == ASP_NUMA_FIXED)? numa_node : NUMA_NO_NODE;
+	if(source != NULL) {
+		retval = asp_mycdev_share_store(source, mycdev);
+		if(retval)
+			goto FAIL;
 	}
 
-	/* copy to user and update the offset in the device */
-	mycdev->devReset = false;
-	retval = count - copy_from_user((mycdev->  ramdisk + *f_offset), buf, count);
-	*f_offset += retval;
+	/* Setup device node and cdev here, NOTE:: This makes the device go live! */
+	mycdev->dev.class = asp_mycdev_class;
+	mycdev->dev.devt = MKDEV(mycdev_major, mycdev_minor + devID);
+	mycdev->dev.groups = asp_mycdev_groups;
+	dev_set_drvdata(&mycdev->dev, mycdev);
+	retval = dev_set_name(&mycdev->dev, MODULE_NODE_NAME"%u", devID);
+	if(retval)
+		goto FAIL;
+	cdev_init(&mycdev->cdev, &asp_mycdev_fileops);
+	mycdev->cdev.owner = THIS_MODULE;
+	retval = cdev_device_add(&mycdev->cdev, &mycdev->dev);
+	if(retval)
+		goto FAIL;
 
-	printk(KERN_DEBUG "%s: device %s%d: bytes written: %d, current position: %d\n",\
-		MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, (int)retval, (int)*f_offset);
+	/* fills the reserved entry, allocates nothing */
+	xa_store(&asp_mycdev_devices, devID, mycdev, GFP_KERNEL);
+	printk(KERN_INFO "%s: Created device %s%u, size: %zu, mode: %#x\n",\
+		MODULE_NAME, "/dev/"MODULE_NODE_NAME, devID, mycdev->ramdiskSize, mode);
+	return devID;
 
-EXIT:
-	mutex_unlock(&mycdev->lock);			/* EXIT Critical Section */
+FAIL:
+	xa_erase(&asp_mycdev_devices, devID);
+PUT:
+	printk(KERN_WARNING "%s: Failed to create device %d: %d\n", MODULE_NAME, id, retval);
+	put_device(&mycdev->dev);
 	return retval;
 }
 
 
-/* set the ramdisk offset to desired offset in the device */
 /**
- * asp_mycdev_lseek -
- * @filp: file pointer
- * @f_offset: requested offset to be set the file
- * @action: SEEK_SET/ SEEK_CUR/ SEEK_END
+ * asp_mycdev_destroy -
+ * @devID: device number
  * Description:
- 		Set the current position in ramdisk to desired offset, based on action:
-		SEEK_SET: set to requested offset
-		SEEK_CUR: set to current offset + requested offset
-		SEEK_END: set to the requested offset from the end of file
-
-		This function also resizes the ramdisk in the device if the requested offset
-		is beyond the current file ramdisk size, and fills the extra region with zeros
- * Return:
+ 		Unregisters a device. Files still open on it keep working until they are
+		closed, the last one frees it. The caller holds asp_mycdev_devices_lock.
+ * Return: 0 on success, -ENODEV if there is no such device
  */
-loff_t asp_mycdev_lseek(struct file *filp, loff_t f_offset, int action)
+static int asp_mycdev_destroy(u32 devID)
 {
-	loff_t new_offset;
-	struct asp_mycdev *mycdev = filp->private_data;
+	struct asp_mycdev *mycdev = xa_erase(&asp_mycdev_devices, devID);
 
-	/* ENTER Critical Section */
-	if(mutex_lock_interruptible(&mycdev->lock))
-		return -ERESTARTSYS;
+	if(mycdev == NULL)
+		return -ENODEV;
 
-	switch (action)
-	{
-		case SEEK_SET:
-			new_offset = f_offset;
-			break;
+	cdev_device_del(&mycdev->cdev, &mycdev->dev);
+	put_device(&mycdev->dev);
+	printk(KERN_INFO "%s: Destroyed device %s%u\n", MODULE_NAME, "/dev/"MODULE_NODE_NAME, devID);
+	return 0;
+}
 
-		case SEEK_CUR:
-			new_offset = filp->f_pos + f_offset;
-			break;
 
-		case SEEK_END:
-			new_offset = mycdev->ramdiskSize + f_offset;
-			break;
+/**
+ * asp_mycdev_snapshot -
+ * @mycdev: device to take a snapshot of
+ * @uid: in, number of the new device or -1 for the first free one, out, the number it got
+ * Description: Creates a copy-on-write snapshot of mycdev as a new device, see asp_mycdev_share_store
+ * Return: 0 on success, errno otherwise
+ */
+static long asp_mycdev_snapshot(struct asp_mycdev *mycdev, s32 __user *uid)
+{
+	long retval = 0;
+	s32 id = 0;
 
-		default:
-			new_offset = -EINVAL;
-			goto EXIT;
-	}
-	/* validity checks (lower boundary) */
-	new_offset = (new_offset < 0)? 0: new_offset;
+	if(!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+	if(get_user(id, uid))
+		return -EFAULT;
 
-	printk(KERN_DEBUG "%s: device %s%d: Current offset: %ld, Requested offset: %ld\n",\
-	MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, (long) filp->f_pos, (long) new_offset);
+	mutex_lock(&asp_mycdev_devices_lock);
+	retval = asp_mycdev_create(id, READ_ONCE(mycdev->ramdiskSize),\
+		READ_ONCE(mycdev->mode) & ~(ASP_MODE_FIFO | ASP_MODE_RING), mycdev);
+	mutex_unlock(&asp_mycdev_devices_lock);
+	if(retval < 0)
+		return retval;
 
-	/* if the new_offset is beyond the current size of ramdisk,
-	reallocate ramdisk to hold double the current size
-	and fill the remaining region with all zeros */
-	if(new_offset > mycdev->ramdiskSize)
-	{
-		char *new_ramdisk = NULL;
-		int pages = -1;
-		size_t old_ramdiskSize = -1;
-		size_t new_ramdiskSize = -1;
+	return put_user((s32) retval, uid)? -EFAULT : 0;
+}
 
-		/* find the new ramdisk size which is multiple of PAGE_SIZE */
-		pages = new_offset / PAGE_SIZE;		// Assert (pages >= 1)
-		pages = (new_offset % PAGE_SIZE > 0)? pages+1 : pages;
-		new_ramdiskSize = pages * PAGE_SIZE;
 
-		/* reallocate ramdisk */
-		new_ramdisk = krealloc(mycdev->ramdisk, new_ramdiskSize, GFP_KERNEL);
-		if(new_ramdisk != NULL)
+/* Control device, /dev/mycdev-control */
+/**
+ * asp_mycdev_ctl_ioctl -
+ * @filp: file pointer of the control device
+ * @cmd: ASP_CTL_CREATE, ASP_CTL_DESTROY or ASP_CTL_LIST
+ * @arg: user pointer to the argument of cmd
+ * Description: Creates, destroys and lists the devices at runtime
+ * Return: 0 on success, errno otherwise
+ */
+static long asp_mycdev_ctl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	long retval = 0;
+
+	switch (cmd)
+	{
+		/* create a device and report its number */
+		case ASP_CTL_CREATE:
 		{
-			/* save old ramdiskSize, we will need it to update the expanded memory */
-			old_ramdiskSize = mycdev->ramdiskSize;
-			/* realloc succeeded, zero out the extra memory */
-			mycdev->ramdisk = new_ramdisk;
-			mycdev->ramdiskSize = new_ramdiskSize;
-			memset(mycdev->ramdisk + old_ramdiskSize, 0, new_ramdiskSize - old_ramdiskSize);
-
-			printk(KERN_DEBUG "%s: device %s%d: Ramdisk resized! "
-				"old_ramdiskSize: %d, new_ramdiskSize: %d, zerod out memory: %d\n",\
-				MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, \
-				(int) old_ramdiskSize, (int) new_ramdiskSize, (int) (new_ramdiskSize - old_ramdiskSize));
-		}
-		else {
-			/* realloc failed, old ramdisk handle is still valid */
-			printk(KERN_DEBUG "%s: device %s%d: Failed to reallocate ramdisk!\n",\
-				MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID);
-
-			new_offset = -ENOMEM;
-			goto EXIT;
-		}
-	}
-	/* update the current seek */
-	filp->f_pos = new_offset;
+			struct asp_mycdev_create req = { 0 };
 
-	printk(KERN_DEBUG "%s: device %s%d: Seeking to position: %ld\n",\
-		MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID, (long) new_offset);
+			if(!capable(CAP_SYS_ADMIN))
+				return -EPERM;
+			if(copy_from_user(&req, (void __user *) arg, sizeof(req)))
+				return -EFAULT;
+			if(req.size > SIZE_MAX)
+				return -EINVAL;
 
-EXIT:
-	mutex_unlock(&mycdev->lock);
-	return new_offset;
-}
+			mutex_lock(&asp_mycdev_devices_lock);
+			retval = asp_mycdev_create(req.id, req.size? req.size : ramdisk_size_in_bytes, req.mode, NULL);
+			mutex_unlock(&asp_mycdev_devices_lock);
+			if(retval < 0)
+				break;
 
+			req.id = retval;
+			retval = copy_to_user((void __user *) arg, &req, sizeof(req))? -EFAULT : 0;
+			break;
+		}
 
-/* IOCTL calls */
-long asp_mycdev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
-{
-	long retval = -1;
-	struct asp_mycdev *mycdev = NULL;
+		/* destroy a device */
+		case ASP_CTL_DESTROY:
+		{
+			u32 devID = 0;
 
-	/* Extracts type and number bitfields;
-	don't decode wrong commands; return -ENOTTY (Inappropriate IOCTL)  */
-	if(_IOC_TYPE(cmd) != ASP_MYCDEV_MAGIC)
-		return -ENOTTY;
-	if(_IOC_NR(cmd) > ASP_IOCTL_MAXNR)
-		return -ENOTTY;
+			if(!capable(CAP_SYS_ADMIN))
+				return -EPERM;
+			if(get_user(devID, (u32 __user *) arg))
+				return -EFAULT;
 
-	/* If everything is fine, extract the command and perform action */
-	mycdev = filp->private_data;
+			mutex_lock(&asp_mycdev_devices_lock);
+			retval = asp_mycdev_destroy(devID);
+			mutex_unlock(&asp_mycdev_devices_lock);
+			break;
+		}
 
-	/* Enter Critical Section */
-	if(mutex_lock_interruptible(&mycdev->lock))
-		return -ERESTARTSYS;
+		/* report the numbers of the devices */
+		case ASP_CTL_LIST:
+		{
+			struct asp_mycdev_list __user *ureq = (void __user *) arg;
+			struct asp_mycdev_list req = { 0 };
+			struct asp_mycdev *mycdev = NULL;
+			unsigned long index = 0;
+			u32 __user *ids = NULL;
+			u32 count = 0;
 
-	switch (cmd)
-	{
-		/* clear the ramdisk & seek to start of the file */
-		case ASP_CLEAR_BUF:
-			memset(mycdev->ramdisk, 0, mycdev->ramdiskSize);
-			filp->f_pos = 0;
-			mycdev->devReset = true;
-			retval = 1;
+			if(copy_from_user(&req, ureq, sizeof(req)))
+				return -EFAULT;
+			ids = u64_to_user_ptr(req.ids);
+
+			mutex_lock(&asp_mycdev_devices_lock);
+			xa_for_each(&asp_mycdev_devices, index, mycdev)
+			{
+				if(count < req.count && put_user((u32) index, ids + count)) {
+					retval = -EFAULT;
+					break;
+				}
+				count++;
+			}
+			mutex_unlock(&asp_mycdev_devices_lock);
+
+			if(retval == 0)
+				retval = put_user(count, &ureq->count);
 			break;
+		}
 
-		/* the control is unlikely to come here after MAXNR check above */
 		default:
 			retval = -ENOTTY;
 	}
-
-	/* Exit Critical Section */
-	mutex_unlock(&mycdev->lock);
-
-	/* Just to debug */
-	if(retval == 1){
-		printk(KERN_DEBUG "%s: device %s%d: Successful Reset!\n",\
-			MODULE_NAME, "/dev/"MODULE_NODE_NAME, mycdev->devID);
-	}
 	return retval;
 }
 
 
-/* fileops for asp_mycdev */
-static struct file_operations asp_mycdev_fileops = {
+/* fileops for the control device */
+static const struct file_operations asp_mycdev_ctl_fileops = {
 	.owner  = THIS_MODULE,
-	.open   = asp_mycdev_open,
-	.read   = asp_mycdev_read,
-	.llseek = asp_mycdev_lseek,
-	.write  = asp_mycdev_write,
-	.release = asp_mycdev_release,
-	.unlocked_ioctl = asp_mycdev_ioctl,
+	.unlocked_ioctl = asp_mycdev_ctl_ioctl,
 };
 
-
-/**
- * setup_cdev -
- * @dev: custom device struct for this driver
- * @index: index/offset to add to start of minor
- * Description: Helper function for init to setup cdev struct in asp_mycdev.
- */
-static int setup_cdev(struct asp_mycdev *dev, int index)
-{
-	int error = 0;
-	int retval = 0;
-	dev_t devNo = 0;
-
-	/* Device Number */
-	devNo = MKDEV(mycdev_major, mycdev_minor + index);
-	/* Init cdev */
-	cdev_init(&dev->cdev, &asp_mycdev_fileops);
-	dev->cdev.owner = THIS_MODULE,
-	dev->cdev.ops = &asp_mycdev_fileops;
-	/* Add the device, NOTE:: This makes the device go live! */
-	error = cdev_add(&dev->cdev, devNo, 1);
-	/* report error */
-	if(error) {
-		printk(KERN_WARNING "%s: Error %d adding mycdev%d\n", MODULE_NAME, error, index);
-		retval = -1;
-	}
-	return retval;
-}
+static struct miscdevice asp_mycdev_ctl = {
+	.minor  = MISC_DYNAMIC_MINOR,
+	.name   = MODULE_CONTROL_NAME,
+	.fops   = &asp_mycdev_ctl_fileops,
+	.mode   = 0600,
+};
 
 
 
@@ -379,27 +4036,45 @@ static int setup_cdev(struct asp_mycdev *dev, int index)
 static int mycdev_init_module(void)
 {
 	dev_t devNum = 0;
-	bool ramdiskAllocFailed = false;
-	bool cdevSetupFailed = false;
-	bool nodeSetupFailed = false;
 	int i = 0, retval = 0;
 
 	printk(KERN_INFO "%s: Initializing Module!\n", MODULE_NAME);
 
+	if(max_devices < 0 || max_devices > ASP_MAX_DEVICES){
+		printk(KERN_WARNING "%s: max_devices must be within 0 and %d\n", MODULE_NAME, ASP_MAX_DEVICES);
+		return -EINVAL;
+	}
+	if(asp_mycdev_check_numa(numa_policy, numa_node)){
+		printk(KERN_WARNING "%s: Invalid numa_policy %d/numa_node %d\n", MODULE_NAME, numa_policy, numa_node);
+		return -EINVAL;
+	}
+	if(compress_interval < 1){
+		printk(KERN_WARNING "%s: compress_interval must be at least 1\n", MODULE_NAME);
+		return -EINVAL;
+	}
+	if(max_size_in_bytes < 0 || !PAGE_ALIGNED(max_size_in_bytes) ||\
+		(max_size_in_bytes && max_size_in_bytes < ramdisk_size_in_bytes)){
+		printk(KERN_WARNING "%s: max_size_in_bytes must be 0 or a multiple of %lu not below ramdisk_size_in_bytes\n",\
+			MODULE_NAME, PAGE_SIZE);
+		return -EINVAL;
+	}
+
 	/* Allocate major and range of minor numbers to work with the driver dynamically
-	 unless otherwise specified at load time */
+	 unless otherwise specified at load time; minors for every possible device
+	 are reserved, devices themselves are only allocated when created */
 	if(mycdev_major || mycdev_minor) {
 		devNum = MKDEV(mycdev_major, mycdev_minor);
-		retval = register_chrdev_region(devNum, max_devices, MODULE_NODE_NAME);
+		retval = register_chrdev_region(devNum, ASP_MAX_DEVICES, MODULE_NODE_NAME);
 	}
 	else {
-		retval = alloc_chrdev_region(&devNum, mycdev_minor, max_devices, MODULE_NODE_NAME);
+		retval = alloc_chrdev_region(&devNum, mycdev_minor, ASP_MAX_DEVICES, MODULE_NODE_NAME);
 		mycdev_major = MAJOR(devNum);
 	}
 	if(retval < 0){
 		printk(KERN_WARNING "%s: Unable to allocate major %d\n", MODULE_NAME, mycdev_major);
 		return retval;
 	}
+	chrdevRegistered = true;
 	printk(KERN_DEBUG "%s: Requested Devices - %d, Major :- %d, Minor - %d\n",\
 		MODULE_NAME, max_devices, mycdev_major, mycdev_minor);
 
@@ -413,82 +4088,56 @@ static int mycdev_init_module(void)
 	}
 	printk(KERN_INFO "%s: Created device class: %s\n", MODULE_NAME, MODULE_CLASS_NAME);
 
-	/* Allocate and setup the devices here */
-	mycdev_devices = kzalloc(max_devices * sizeof(struct asp_mycdev), GFP_KERNEL);
-	if(mycdev_devices == NULL){
+	/* Cleared page stores are released in the background */
+	asp_mycdev_wq = alloc_workqueue(MODULE_NAME, WQ_UNBOUND, 0);
+	if(asp_mycdev_wq == NULL){
 		retval = -ENOMEM;
 		goto FAIL;
 	}
+	asp_mycdev_tfms = asp_mycdev_alloc_tfms();
+	if(asp_mycdev_tfms == NULL)
+		printk(KERN_WARNING "%s: %s is not available, ASP_MODE_COMPRESS is disabled\n",\
+			MODULE_NAME, compressor);
+	retval = simple_pin_fs(&asp_mycdev_fs_type, &asp_mycdev_mnt, &asp_mycdev_mnt_count);
+	if(retval < 0)
+		goto FAIL;
 
-	/* Setup the devices */
-	for(i = 0; i < max_devices; i++)
-	{
-		char nodeName[MAX_NODE_NAME_SIZE] = { 0 };
-		int cdevStatus = 0;
-
-		/* Device Reset flag */
-		mycdev_devices[i].devReset = true;
-		/* Device number */
-		mycdev_devices[i].devID = i;
-		/* Initializing Mutex */
-		mutex_init(&mycdev_devices[i].lock);
-
-		/* Initializing ramdisk */
-		mycdev_devices[i].ramdisk = kzalloc((size_t) ramdisk_size_in_bytes, GFP_KERNEL);
-		if(mycdev_devices[i].ramdisk == NULL){
-			/* mark that we failed to allocate current device memory,
-			we will clean up previously allocated devices in cleanup module */
-			printk(KERN_WARNING "%s: Failed to allocate ramdisk for device %d\n", MODULE_NAME, i);
-			ramdiskAllocFailed = true;
-			break;	/* exit for */
-		}
-		lastSuccessfulRamdisk = i;
-		mycdev_devices[i].ramdiskSize = ramdisk_size_in_bytes;
-
-		/* Create device node here */
-		snprintf(nodeName, sizeof(nodeName), MODULE_NODE_NAME"%d", i);
+	/* Pages of ASP_MODE_CACHE devices are given back under memory pressure */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+	retval = register_shrinker(&asp_mycdev_shrinker, MODULE_NAME);
+#else
+	retval = register_shrinker(&asp_mycdev_shrinker);
+#endif
+	if(retval < 0)
+		goto FAIL;
+	shrinkerRegistered = true;
 
-		mycdev_devices[i].device = device_create(asp_mycdev_class, NULL,\
-			MKDEV(mycdev_major, mycdev_minor + i), NULL, nodeName);
-		if(IS_ERR_OR_NULL(mycdev_devices[i].device))
-		{
-			/* mark that we failed to create and register current device node with sysfs,
-			we will clean up previously device nodes in cleanup module */
-			printk(KERN_WARNING "%s: Failed to Create Device Node %s\n", MODULE_NAME, nodeName);
-			nodeSetupFailed = true;
-			break;
-		}
-		lastSuccessfulNode = i;
+	/* Setup the devices requested at load time */
+	mutex_lock(&asp_mycdev_devices_lock);
+	for(i = 0; i < max_devices && retval >= 0; i++)
+		retval = asp_mycdev_create(i, ramdisk_size_in_bytes, 0, NULL);
+	mutex_unlock(&asp_mycdev_devices_lock);
+	if(retval < 0)
+		goto FAIL;
 
-		/* Setup cdev struct here */
-		cdevStatus = setup_cdev(&mycdev_devices[i], i);
-		if(cdevStatus < 0){
-			/* mark that we failed to allocate current cdev,
-			we will clean up previously allocated cdevs in cleanup module */
-			printk(KERN_WARNING "%s: Failed to setup cdev for device %d\n", MODULE_NAME, i);
-			cdevSetupFailed = true;
-			break;
-		}
-		lastSuccessfulCdev = i;
-	}
-	/* cleanup if we failed to allocate device memory */
-	if(ramdiskAllocFailed || nodeSetupFailed || cdevSetupFailed)
-	{
-		retval = -ENOMEM;
+	/* The control device goes last, nothing can be created before we are ready */
+	retval = misc_register(&asp_mycdev_ctl);
+	if(retval < 0){
+		printk(KERN_WARNING "%s: Failed to register %s\n", MODULE_NAME, MODULE_CONTROL_NAME);
 		goto FAIL;
 	}
+	ctlRegistered = true;
 
 	printk(KERN_INFO "%s: Initialization Complete!\n", MODULE_NAME);
-	printk(KERN_INFO "%s: lastSuccessfulRamdisk: %d, lastSuccessfulNode: %d, lastSuccessfulCdev: %d\n",\
-	 MODULE_NAME, lastSuccessfulRamdisk, lastSuccessfulNode, lastSuccessfulCdev);
-
 	return 0;
 
 FAIL:
 	mycdev_cleanup_module();
 	return retval;
 }
+#ifndef ASP_MYCDEV_KUNIT		/* asp_mycdev_test.c brings the module up per test case */
 module_init(mycdev_init_module);
+#endif
 
 
 
@@ -499,43 +4148,48 @@ module_init(mycdev_init_module);
  */
 static void mycdev_cleanup_module(void)
 {
-	int i = 0;
+	struct asp_mycdev *mycdev = NULL;
+	unsigned long index = 0;
+	int count = 0;
 
 	printk(KERN_INFO "%s: Cleaning Up Module!\n", MODULE_NAME);
 
-	/* we will free lastSuccessful constructs here */
-	/* Cleanup devices */
-	if(mycdev_devices != NULL)
+	/* no more devices can be created once the control device is gone */
+	if(ctlRegistered){
+		misc_deregister(&asp_mycdev_ctl);
+		ctlRegistered = false;
+	}
+
+	if(shrinkerRegistered){
+		unregister_shrinker(&asp_mycdev_shrinker);
+		shrinkerRegistered = false;
+	}
+
+	/* Cleanup devices, nothing has them open since the module is going away */
+	mutex_lock(&asp_mycdev_devices_lock);
+	xa_for_each(&asp_mycdev_devices, index, mycdev)
 	{
-		/* ramdisk */
-		for(i = 0; i <= lastSuccessfulRamdisk; i++)
-		{
-			if(mycdev_devices[i].ramdisk != NULL)
-			{
-				kfree(mycdev_devices[i].ramdisk);
-				mycdev_devices[i].ramdisk = NULL;
-			}
-		}
-		/* cdev */
-		for(i = 0; i <= lastSuccessfulCdev; i++)
-		{
-			cdev_del(&mycdev_devices[i].cdev);
-		}
-		/* device nodes */
-		for(i = 0; i <= lastSuccessfulNode; i++)
-		{
-			device_destroy(asp_mycdev_class, MKDEV(mycdev_major, mycdev_minor + i));
-		}
-		/* free up device array */
-		kfree(mycdev_devices);
-		mycdev_devices = NULL;
+		asp_mycdev_destroy(index);
+		count++;
+	}
+	mutex_unlock(&asp_mycdev_devices_lock);
+	xa_destroy(&asp_mycdev_devices);
+	printk(KERN_DEBUG "%s: Freed up %d devices.\n", MODULE_NAME, count);
+
+	if(asp_mycdev_mnt != NULL){
+		simple_release_fs(&asp_mycdev_mnt, &asp_mycdev_mnt_count);
+		asp_mycdev_mnt = NULL;
+	}
 
-		printk(KERN_DEBUG "%s: Freed up %d devices/ramdisks.\n",\
-			MODULE_NAME, lastSuccessfulRamdisk + 1);
-		printk(KERN_DEBUG "%s: Freed up %d devices/nodes.\n",\
-			MODULE_NAME, lastSuccessfulNode + 1);
-		printk(KERN_DEBUG "%s: Freed up %d devices/cdevs.\n",\
-			MODULE_NAME, lastSuccessfulCdev + 1);
+	/* wait for the stores cleared by ASP_CLEAR_BUF, queued after a grace period */
+	if(asp_mycdev_wq != NULL){
+		rcu_barrier();
+		destroy_workqueue(asp_mycdev_wq);
+		asp_mycdev_wq = NULL;
+	}
+	if(asp_mycdev_tfms != NULL){
+		asp_mycdev_free_tfms(asp_mycdev_tfms);
+		asp_mycdev_tfms = NULL;
 	}
 
 	/* Clean up device class */
@@ -545,13 +4199,18 @@ static void mycdev_cleanup_module(void)
 		printk(KERN_DEBUG "%s: Freed up %s device class.\n", MODULE_NAME, MODULE_CLASS_NAME);
 	}
 
-	/* Cleaning up the chrdev_region,
-	this is never called if the registration failes */
-	unregister_chrdev_region(MKDEV(mycdev_major, mycdev_minor), max_devices);
+	/* Cleaning up the chrdev_region */
+	if(chrdevRegistered){
+		unregister_chrdev_region(MKDEV(mycdev_major, mycdev_minor), ASP_MAX_DEVICES);
+		chrdevRegistered = false;
+	}
 
 	printk(KERN_INFO "%s: Cleanup Done!\n", MODULE_NAME);
 }
+#ifndef ASP_MYCDEV_KUNIT
 module_exit(mycdev_cleanup_module);
+#endif
+
 
 /* Driver Info */
 MODULE_LICENSE("GPL");
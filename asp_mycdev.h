@@ -13,8 +13,20 @@
 #ifndef __ASP_MYCDEV__
 #define __ASP_MYCDEV__
 
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* Everything up to the IOCTLs is private to the driver, the rest of this
+header is shared with the user space test and benchmark programs */
+#ifdef __KERNEL__
+
 #include <linux/mutex.h>
+#include <linux/rwsem.h>
+#include <linux/seqlock.h>
+#include <linux/wait.h>
 #include <linux/device.h>
+#include <linux/xarray.h>
+#include <linux/workqueue.h>
 
 /* Defaul size of each device - keep it multiple of PAGE_SIZE */
 #define  DEFAULT_RAMDISK_SIZE  2*PAGE_SIZE
@@ -27,31 +39,369 @@
 /* mycdev0 to mycdev3 */
 #define   DEFAULT_NUM_DEVICES  3
 
+/* Number of minors reserved for the devices, created at load time or through
+the control device; only the devices in use are allocated */
+#define   ASP_MAX_DEVICES  4096
+
+/* Lock striping: the ramdisk is cut into units of 1 << ASP_STRIPE_SHIFT bytes
+and unit n is guarded by stripe n % ASP_NR_STRIPES. Keep ASP_NR_STRIPES well
+below lockdep's MAX_LOCK_DEPTH, a batch spanning many units holds all of them at once. */
+#define  ASP_STRIPE_SHIFT    16
+#define  ASP_NR_STRIPES      16
+
+/* Locked reads and writes are served in slices of one stripe unit, the locks
+are dropped and the task may be rescheduled between two slices */
+#define  ASP_IO_SLICE        (1UL << ASP_STRIPE_SHIFT)
+
+/* Huge pages of ASP_MODE_HUGE: one compound page backs an aligned block of
+ASP_HUGE_NR ramdisk pages, so it can be mapped by a single PMD */
+#define  ASP_HUGE_ORDER   (PMD_SHIFT - PAGE_SHIFT)
+#define  ASP_HUGE_NR      (1UL << ASP_HUGE_ORDER)
+
+/* Number of optimistic attempts of a lockless read before it takes the locks */
+#define  ASP_LOCKLESS_READ_RETRIES  4
+
 /* Module name */
 #define  MODULE_NAME     "asp_mycdev"
 #define  MODULE_CLASS_NAME  "asp_mycdev_class"
 #define  MODULE_NODE_NAME   "mycdev"
+#define  MODULE_CONTROL_NAME  "mycdev-control"
 #define  MAX_NODE_NAME_SIZE  10
 
+/* Operations accounted in the per-device statistics */
+enum asp_mycdev_op
+{
+	ASP_OP_READ,
+	ASP_OP_WRITE,
+	ASP_OP_SEEK,
+	ASP_OP_IOCTL,
+	ASP_NR_OPS
+};
+
+/* Latency histograms have log2 buckets of nanoseconds: bucket 0 counts 0ns,
+bucket n counts [2^(n-1), 2^n) ns and the last bucket is open ended */
+#define  ASP_HIST_BUCKETS    32
+
+/* Per-CPU statistics of a device, summed up when read through sysfs */
+struct asp_mycdev_stats
+{
+	u64 ops[ASP_NR_OPS]; /* completed operations */
+	u64 bytes[ASP_NR_OPS]; /* bytes transferred, read and write only */
+	u64 resizes; /* successful growths of the ramdisk */
+	u64 clears; /* ASP_CLEAR_BUF calls */
+	u64 errors; /* operations which returned an error */
+	u64 numaMisses; /* pages which could not be placed on the node the policy asked for */
+	u64 hugePages; /* huge blocks allocated in ASP_MODE_HUGE */
+	u64 hugeFallbacks; /* huge allocations which failed and fell back to small pages */
+	u64 cowCopies; /* pages shared with a snapshot which were copied on write */
+	u64 zeroPages; /* idle pages found zero filled and dropped in ASP_MODE_COMPRESS */
+	u64 reclaimedPages; /* pages dropped by the shrinker in ASP_MODE_CACHE */
+	u64 decompressLatency[ASP_HIST_BUCKETS]; /* time to decompress a page */
+	u64 latency[ASP_NR_OPS][ASP_HIST_BUCKETS]; /* op latency */
+	u64 lockWait[ASP_HIST_BUCKETS]; /* time spent waiting for resizeLock and stripes */
+};
+
+/* Page store of a device, replaced as a whole by ASP_CLEAR_BUF */
+struct asp_mycdev_store
+{
+	struct xarray pages; /* device memory, one page per index, holes read as zeros */
+	struct rcu_work free; /* releases a replaced store once lockless readers are gone */
+	unsigned long nrPages; /* page entries, for the shrinker; these four change under allocLock */
+	unsigned long zpages; /* compressed entries */
+	unsigned long zbytes; /* bytes taken by the compressed entries */
+	unsigned long fillPages; /* same-filled entries, which take no memory */
+};
+
+/* A page of ASP_MODE_COMPRESS compressed by the crypto API, kept only if it
+shrank to ASP_ZPAGE_MAX bytes at most */
+struct asp_mycdev_zpage
+{
+	unsigned int len; /* bytes of data */
+	u8 data[];
+};
+#define  ASP_ZPAGE_MAX     (PAGE_SIZE * 3 / 4)
+
+/* Mark of the store entries shared with a snapshot, copied before they are written */
+#define  ASP_PAGE_SHARED   XA_MARK_0
+
+/* Per-range lock of a device */
+struct asp_mycdev_stripe
+{
+	struct mutex lock; /* serializes I/O within the units of this stripe */
+	seqcount_t seq; /* bumped around writes, written only under lock */
+} ____cacheline_aligned_in_smp;
+
+/* State of a device in ASP_MODE_FIFO, the ramdisk is used as a ring buffer */
+struct asp_mycdev_fifo
+{
+	struct mutex lock; /* serializes readers and writers, nests inside resizeLock */
+	u64 head; /* bytes consumed so far, the ring offset is head % ramdiskSize */
+	u64 tail; /* bytes produced so far, tail - head bytes are queued */
+	wait_queue_head_t readq; /* readers waiting for data */
+	wait_queue_head_t writeq; /* writers waiting for space */
+};
+
+/* State of a device in ASP_MODE_APPEND, the ramdisk holds the log from offset 0 */
+struct asp_mycdev_log
+{
+	atomic64_t tail; /* end of the reserved records, appenders move it with a compare-and-swap */
+	atomic64_t committed ____cacheline_aligned_in_smp; /* records below are complete, reads stop here */
+	spinlock_t lock; /* moves committed and keeps done */
+	struct list_head done; /* records complete beyond committed, by offset */
+};
+
+/* A record of ASP_MODE_APPEND copied before one reserved ahead of it */
+struct asp_mycdev_log_done
+{
+	struct list_head list;
+	s64 start, end;
+};
+
+struct eventfd_ctx;
+
+/* State of a device in ASP_MODE_RING, the data lives in the ramdisk pages */
+struct asp_mycdev_ring_state
+{
+	struct page *page; /* struct asp_mycdev_ring shared with user space, allocated on first use */
+	struct eventfd_ctx *dataEvent; /* signalled by ASP_RING_KICK_DATA, or NULL */
+	struct eventfd_ctx *spaceEvent; /* signalled by ASP_RING_KICK_SPACE, or NULL */
+};
+
 /* Device struct */
 struct asp_mycdev
 {
 	int devID; /* device ID */
-	char *ramdisk; /* device */
+	struct asp_mycdev_store __rcu *store; /* device memory, replaced under resizeLock and mapLock */
 	size_t ramdiskSize; /* device size */
-	struct mutex lock; /* mutex for this device */
+	unsigned int mode; /* ASP_MODE_* flags, changed under resizeLock exclusively */
+	u32 numaPolicy; /* ASP_NUMA_* placement of new pages, changed under resizeLock exclusively */
+	int numaNode; /* node of ASP_NUMA_FIXED */
+	struct rw_semaphore resizeLock; /* shared for I/O, exclusive for resize and clear */
+	seqcount_t resizeSeq; /* bumped around clear, written only under resizeLock */
+	struct asp_mycdev_stripe stripes[ASP_NR_STRIPES]; /* range locks, nest inside resizeLock */
+	struct rw_semaphore mapLock; /* mmap faults vs. ramdiskSize updates */
+	struct mutex allocLock; /* serializes filling holes, innermost */
+	struct asp_mycdev_fifo fifo; /* ring buffer state in ASP_MODE_FIFO */
+	struct asp_mycdev_ring_state ring; /* shared ring state in ASP_MODE_RING, under resizeLock */
+	struct asp_mycdev_log log; /* tail and watermark in ASP_MODE_APPEND, reset under resizeLock */
+	struct address_space *mapping; /* shared by all opens, so a clear can zap every mapping */
 	struct cdev cdev; /* char device struct */
-	struct device *device; /* device node in sysfs */
+	struct device dev; /* device node in sysfs, its release frees the struct */
+	size_t initialSize; /* ramdisk size at creation, restored by ASP_CLEAR_SHRINK */
+	size_t maxSize; /* lseek does not grow the ramdisk beyond it, 0 for no cap, under resizeLock */
+	unsigned long reclaimNext; /* page index the shrinker goes on from, under asp_mycdev_devices_lock */
+	struct asp_mycdev_stats __percpu *stats; /* exported in sysfs under stats/ */
+	struct delayed_work compressWork; /* looks for idle pages in ASP_MODE_COMPRESS */
 	bool devReset; /* flag to indicate that the device is reset */
 };
 
+#endif /* __KERNEL__ */
+
+/* Device modes, see ASP_SET_MODE */
+/* reads take no lock and retry if a write or clear touched their range */
+#define ASP_MODE_LOCKLESS_READ  (1U << 0)
+/* pipe semantics: the ramdisk is a ring buffer, reads consume what writes
+produced, both block (or fail with EAGAIN under O_NONBLOCK) and poll works */
+#define ASP_MODE_FIFO  (1U << 1)
+/* single producer/single consumer ring shared through mmap, see struct
+asp_mycdev_ring, the kernel is only entered to sleep and to wake up a peer */
+#define ASP_MODE_RING  (1U << 2)
+/* back newly written ranges with 2 MiB compound pages where possible, and map
+them with PMDs; small pages are used where a huge one can not be had */
+#define ASP_MODE_HUGE  (1U << 3)
+/* compress pages which stay idle for compress_interval seconds, and
+decompress them on their next access; mapped pages are never compressed */
+#define ASP_MODE_COMPRESS  (1U << 4)
+/* the contents are discardable: under memory pressure the shrinker drops idle
+pages, which read as zeros afterwards; mapped and shared pages are kept */
+#define ASP_MODE_CACHE  (1U << 5)
+/* append-only log: every write lands at the tail whatever the file position,
+concurrent records never interleave and reads stop at the last complete one;
+the log starts empty at offset 0 when the mode is set and on a clear */
+#define ASP_MODE_APPEND  (1U << 6)
+#define ASP_MODE_MASK  (ASP_MODE_LOCKLESS_READ | ASP_MODE_FIFO | ASP_MODE_RING | ASP_MODE_HUGE |\
+	ASP_MODE_COMPRESS | ASP_MODE_CACHE | ASP_MODE_APPEND)
+
+/* Shared ring of ASP_MODE_RING
+
+   The data area is the ramdisk, mapped from offset 0. This header is mapped
+   from ASP_RING_HEADER_OFFSET, a single page. Byte n of the stream lives at
+   data offset n % size. The producer fills [tail, head + size) and then
+   publishes with a release store to tail. The consumer reads [head, tail)
+   after an acquire load of tail and frees it with a release store to head.
+   Neither side ever writes the other's index.
+
+   To sleep, a side sets its ASP_RING_WAIT_* bit in waiting. It then issues a
+   full barrier and rechecks the indices. If there is still nothing to do, it
+   waits in poll() or on its eventfd. After publishing, the peer issues a full
+   barrier. If it finds the bit set, it clears it and rings the doorbell with
+   ASP_RING_KICK. Entering ASP_MODE_RING or ASP_CLEAR_BUF resets the header,
+   with size set to the ramdisk size at that time. */
+struct asp_mycdev_ring
+{
+	__u64 head; /* bytes consumed, written by the consumer only */
+	__u64 pad0[7];
+	__u64 tail; /* bytes produced, written by the producer only */
+	__u64 pad1[7];
+	__u64 size; /* capacity of the data area in bytes, set by the driver */
+	__u32 waiting; /* ASP_RING_WAIT_* bits of the sides going to sleep */
+	__u32 pad2;
+};
+
+#define ASP_RING_HEADER_OFFSET  (1ULL << 36)
+#define ASP_RING_WAIT_DATA  (1U << 0) /* consumer waits for ASP_RING_KICK_DATA */
+#define ASP_RING_WAIT_SPACE  (1U << 1) /* producer waits for ASP_RING_KICK_SPACE */
+
+/* doorbells of ASP_RING_KICK, passed by value */
+#define ASP_RING_KICK_DATA  (1U << 0) /* new data was published, wake the consumer */
+#define ASP_RING_KICK_SPACE  (1U << 1) /* space was freed, wake the producer */
+
+/* eventfds signalled by the doorbells, -1 for none */
+struct asp_mycdev_ring_eventfd
+{
+	__s32 dataFd;
+	__s32 spaceFd;
+};
+
+/* NUMA placement of the pages of a device, see ASP_SET_NUMA */
+#define ASP_NUMA_LOCAL  0 /* first touch: the node of the CPU which writes the page */
+#define ASP_NUMA_FIXED  1 /* a given node, other nodes only if it is out of memory */
+#define ASP_NUMA_INTERLEAVE  2 /* page n on the n-th online node, round robin */
+#define ASP_NUMA_MAX  ASP_NUMA_INTERLEAVE
+
+/* argument of ASP_SET_NUMA and ASP_GET_NUMA */
+struct asp_mycdev_numa
+{
+	__u32 policy; /* ASP_NUMA_* */
+	__s32 node; /* node of ASP_NUMA_FIXED, ignored otherwise */
+};
+
 /* IOCTLs */
 #define ASP_MYCDEV_MAGIC  0x37
 
 /* clear the ramdisk and sets the file position at the beginning */
 #define ASP_CLEAR_BUF  _IO(ASP_MYCDEV_MAGIC, 0)
 
+/* set the ASP_MODE_* flags of the device */
+#define ASP_SET_MODE  _IOW(ASP_MYCDEV_MAGIC, 1, __u32)
+
+/* get the ASP_MODE_* flags of the device */
+#define ASP_GET_MODE  _IOR(ASP_MYCDEV_MAGIC, 2, __u32)
+
+/* ring the ASP_RING_KICK_* doorbells of a device in ASP_MODE_RING */
+#define ASP_RING_KICK  _IO(ASP_MYCDEV_MAGIC, 3)
+
+/* set the eventfds signalled by ASP_RING_KICK */
+#define ASP_RING_SET_EVENTFD  _IOW(ASP_MYCDEV_MAGIC, 4, struct asp_mycdev_ring_eventfd)
+
+/* like ASP_CLEAR_BUF, and shrink the ramdisk back to its size at creation */
+#define ASP_CLEAR_SHRINK  _IO(ASP_MYCDEV_MAGIC, 5)
+
+/* Control device, creates and destroys the devices at runtime */
+#define ASP_CONTROL_NODE  "/dev/mycdev-control"
+
+/* argument of ASP_CTL_CREATE */
+struct asp_mycdev_create
+{
+	__s32 id; /* in: device number to use or -1 for any, out: the new /dev/mycdev<id> */
+	__u32 mode; /* ASP_MODE_* flags of the new device */
+	__u64 size; /* ramdisk size in bytes, 0 for the ramdisk_size_in_bytes parameter */
+};
+
+/* argument of ASP_CTL_LIST */
+struct asp_mycdev_list
+{
+	__u32 count; /* in: number of entries of ids, out: number of devices */
+	__u32 pad;
+	__u64 ids; /* pointer to a __u32 array, filled in ascending order */
+};
+
+/* create a device, needs CAP_SYS_ADMIN */
+#define ASP_CTL_CREATE  _IOWR(ASP_MYCDEV_MAGIC, 6, struct asp_mycdev_create)
+
+/* destroy a device, open files keep working until closed; needs CAP_SYS_ADMIN */
+#define ASP_CTL_DESTROY  _IOW(ASP_MYCDEV_MAGIC, 7, __u32)
+
+/* list the device numbers in use */
+#define ASP_CTL_LIST  _IOWR(ASP_MYCDEV_MAGIC, 8, struct asp_mycdev_list)
+
+/* set the NUMA placement of the pages allocated from now on */
+#define ASP_SET_NUMA  _IOW(ASP_MYCDEV_MAGIC, 9, struct asp_mycdev_numa)
+
+/* get the NUMA placement of a device */
+#define ASP_GET_NUMA  _IOR(ASP_MYCDEV_MAGIC, 10, struct asp_mycdev_numa)
+
+/* one operation of ASP_BATCH, the file position is neither used nor moved */
+struct asp_mycdev_batch_op
+{
+	__u32 op; /* ASP_BATCH_READ or ASP_BATCH_WRITE */
+	__u32 pad;
+	__u64 offset; /* position in the device */
+	__u64 len; /* bytes to transfer */
+	__u64 buf; /* pointer to the user buffer */
+	__s64 result; /* out: what pread/pwrite would have returned, bytes or -errno */
+};
+
+#define ASP_BATCH_READ  0
+#define ASP_BATCH_WRITE  1
+#define ASP_BATCH_MAX  1024 /* operations per ASP_BATCH call */
+
+/* argument of ASP_BATCH */
+struct asp_mycdev_batch
+{
+	__u64 ops; /* pointer to an array of struct asp_mycdev_batch_op */
+	__u32 count; /* number of operations, at most ASP_BATCH_MAX */
+	__u32 pad;
+};
+
+/* run many reads and writes at scattered offsets under one lock acquisition */
+#define ASP_BATCH  _IOW(ASP_MYCDEV_MAGIC, 11, struct asp_mycdev_batch)
+
+/* argument of ASP_ATOMIC, operates on the native endian 64-bit word at offset */
+struct asp_mycdev_atomic
+{
+	__u32 op; /* ASP_ATOMIC_* */
+	__u32 pad;
+	__u64 offset; /* 8 byte aligned position in the device */
+	__u64 value; /* addend, new value or exchange value */
+	__u64 expected; /* ASP_ATOMIC_CMPXCHG only: value is stored if the word equals this */
+	__u64 old; /* out: the word before the operation */
+};
+
+#define ASP_ATOMIC_FETCH_ADD  0
+#define ASP_ATOMIC_CMPXCHG  1
+#define ASP_ATOMIC_XCHG  2
+
+/* atomic read-modify-write of a device word, also atomic against mmap users */
+#define ASP_ATOMIC  _IOWR(ASP_MYCDEV_MAGIC, 12, struct asp_mycdev_atomic)
+
+/* create a copy-on-write snapshot of the device as a new device,
+in: the number to give it or -1 for the first free one, out: the number it got */
+#define ASP_SNAPSHOT  _IOWR(ASP_MYCDEV_MAGIC, 13, __s32)
+
+/* argument of ASP_COPY_RANGE, issued on the destination device */
+struct asp_mycdev_copy_range
+{
+	__s32 src_fd; /* source device, open for reading, may be the destination */
+	__u32 flags; /* ASP_COPY_* */
+	__u64 src_offset;
+	__u64 dst_offset;
+	__u64 len;
+	__u64 copied; /* out: bytes copied, short at the end of the source */
+};
+
+/* share whole pages copy-on-write instead of copying them, both offsets page aligned */
+#define ASP_COPY_SHARE  (1 << 0)
+
+/* copy a range from another device, or within one, without going through user space */
+#define ASP_COPY_RANGE  _IOWR(ASP_MYCDEV_MAGIC, 14, struct asp_mycdev_copy_range)
+
+/* cap the size the device can be grown to by lseek, in bytes, a page multiple
+and at least the current size, 0 for no cap; setting it needs CAP_SYS_ADMIN */
+#define ASP_SET_LIMIT  _IOW(ASP_MYCDEV_MAGIC, 15, __u64)
+#define ASP_GET_LIMIT  _IOR(ASP_MYCDEV_MAGIC, 16, __u64)
+
 /* Maximum number of IOCTL defs implemented in this driver */
-#define ASP_IOCTL_MAXNR  0
+#define ASP_IOCTL_MAXNR  16
 
 #endif /* __ASP_MYCDEV__ */
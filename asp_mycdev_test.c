@@ -0,0 +1,569 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T21:12:40-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: asp_mycdev_test.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T21:12:40-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   KUnit suite of the driver, built as asp_mycdev_test.ko with "make KUNIT=1"
+   for a kernel with CONFIG_KUNIT, e.g. under UML or QEMU. The driver is
+   compiled into the test module so that its static functions can be called
+   directly: every case brings up the module, creates a device of its own and
+   drives it through the file operations with kernel buffers, the way the
+   syscalls would. The bench cases time the data path per operation without
+   the syscall overhead and report it with kunit_info.
+   The test module can not be loaded together with asp_mycdev.ko.
+ @*/
+
+#define ASP_MYCDEV_KUNIT
+#include "asp_mycdev.c"
+
+#include <kunit/test.h>
+
+/* size of the device of every case, as the default ramdisk_size_in_bytes */
+#define  ASP_TEST_SIZE  (2 * PAGE_SIZE)
+
+/* bench cases cycle through ASP_TEST_BENCH_SPAN bytes, ASP_TEST_BENCH_OPS times */
+#define  ASP_TEST_BENCH_SPAN  (1UL << 20)
+#define  ASP_TEST_BENCH_OPS   20000
+
+struct asp_mycdev_test
+{
+	struct asp_mycdev *mycdev;
+	struct file *filp;		/* carries private_data and f_pos, as open() sets them */
+};
+
+
+/* read or write at the file position through the file operations, buf is kernel memory */
+static ssize_t asp_test_io(struct file *filp, void *buf, size_t len, bool write)
+{
+	struct kvec kvec = { .iov_base = buf, .iov_len = len };
+	struct kiocb kiocb = { .ki_filp = filp, .ki_pos = filp->f_pos };
+	struct iov_iter iter;
+	ssize_t retval = 0;
+
+	iov_iter_kvec(&iter, write? WRITE : READ, &kvec, 1, len);
+	retval = write? asp_mycdev_write_iter(&kiocb, &iter) : asp_mycdev_read_iter(&kiocb, &iter);
+	filp->f_pos = kiocb.ki_pos;
+	return retval;
+}
+
+
+/* number of populated entries of the page store */
+static unsigned long asp_test_nr_pages(struct asp_mycdev *mycdev)
+{
+	unsigned long index = 0, nr = 0;
+	void *entry = NULL;
+
+	down_read(&mycdev->resizeLock);
+	xa_for_each(asp_mycdev_pages(mycdev), index, entry)
+		nr++;
+	up_read(&mycdev->resizeLock);
+	return nr;
+}
+
+
+/* switch the mode as ASP_SET_MODE does */
+static long asp_test_set_mode(struct asp_mycdev *mycdev, u32 mode)
+{
+	long retval = 0;
+
+	down_write(&mycdev->resizeLock);
+	retval = asp_mycdev_set_mode(mycdev, mode);
+	up_write(&mycdev->resizeLock);
+	return retval;
+}
+
+
+static bool asp_test_is_filled(const u8 *buf, size_t len, u8 byte)
+{
+	return memchr_inv(buf, byte, len) == NULL;
+}
+
+
+static int asp_mycdev_test_init(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = kunit_kzalloc(test, sizeof(*ctx), GFP_KERNEL);
+	int retval = 0;
+
+	if(ctx == NULL)
+		return -ENOMEM;
+	ctx->filp = kunit_kzalloc(test, sizeof(*ctx->filp), GFP_KERNEL);
+	if(ctx->filp == NULL)
+		return -ENOMEM;
+
+	retval = mycdev_init_module();
+	if(retval)
+		return retval;
+	mutex_lock(&asp_mycdev_devices_lock);
+	retval = asp_mycdev_create(-1, ASP_TEST_SIZE, 0, NULL);
+	if(retval >= 0)
+		ctx->mycdev = xa_load(&asp_mycdev_devices, retval);
+	mutex_unlock(&asp_mycdev_devices_lock);
+	if(retval < 0) {
+		mycdev_cleanup_module();
+		return retval;
+	}
+
+	ctx->filp->private_data = ctx->mycdev;
+	ctx->filp->f_mode = FMODE_READ | FMODE_WRITE;
+	test->priv = ctx;
+	return 0;
+}
+
+
+static void asp_mycdev_test_exit(struct kunit *test)
+{
+	mycdev_cleanup_module();
+}
+
+
+/* a new device reads as zeros upto its size and allocates nothing doing so */
+static void asp_mycdev_test_read_fresh(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 *buf = kunit_kmalloc(test, ASP_TEST_SIZE, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	memset(buf, 0xa5, ASP_TEST_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, ASP_TEST_SIZE, false), (ssize_t) ASP_TEST_SIZE);
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, ASP_TEST_SIZE, 0));
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) ASP_TEST_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 0UL);
+}
+
+
+/* a write across a page boundary populates both pages and reads back */
+static void asp_mycdev_test_page_boundary(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 in[20], out[20];
+
+	memset(in, 0x5a, sizeof(in));
+	KUNIT_ASSERT_EQ(test, asp_mycdev_lseek(ctx->filp, PAGE_SIZE - 10, SEEK_SET), (loff_t) PAGE_SIZE - 10);
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, in, sizeof(in), true), (ssize_t) sizeof(in));
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) PAGE_SIZE + 10);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 2UL);
+
+	ctx->filp->f_pos = PAGE_SIZE - 10;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, out, sizeof(out), false), (ssize_t) sizeof(out));
+	KUNIT_EXPECT_EQ(test, memcmp(in, out, sizeof(in)), 0);
+}
+
+
+/* reads are cut at the end of the device and return 0 from there on */
+static void asp_mycdev_test_read_past_end(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 buf[16];
+
+	ctx->filp->f_pos = ASP_TEST_SIZE - 5;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) 5);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) ASP_TEST_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) 0);
+
+	ctx->filp->f_pos = ASP_TEST_SIZE + PAGE_SIZE;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) 0);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) ASP_TEST_SIZE + PAGE_SIZE);
+}
+
+
+/* a write which does not fit fails as a whole, the device does not grow */
+static void asp_mycdev_test_write_past_end(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 buf[16] = { 0 };
+
+	ctx->filp->f_pos = ASP_TEST_SIZE - 5;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), true), (ssize_t) -ENOMEM);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) ASP_TEST_SIZE - 5);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->ramdiskSize, (size_t) ASP_TEST_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 0UL);
+
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, 5, true), (ssize_t) 5);
+}
+
+
+/* seeking beyond the end grows the device to a page multiple, the new range is a hole */
+static void asp_mycdev_test_lseek_grow(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	loff_t target = ASP_TEST_SIZE + 100;
+	u8 buf[200];
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, target, SEEK_SET), target);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->ramdiskSize, (size_t) PAGE_ALIGN(target));
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 0UL);
+
+	memset(buf, 0xff, sizeof(buf));
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) sizeof(buf));
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, sizeof(buf), 0));
+
+	/* SEEK_END is relative to the grown size, SEEK_CUR before the start stops at 0 */
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_END), (loff_t) PAGE_ALIGN(target));
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, -2 * (loff_t) PAGE_ALIGN(target), SEEK_CUR), (loff_t) 0);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, 42), (loff_t) -EINVAL);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 0);
+
+	/* a write at the old end, across the page boundary into the grown range */
+	ctx->filp->f_pos = ASP_TEST_SIZE - 8;
+	memset(buf, 0x11, 16);
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, 16, true), (ssize_t) 16);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 2UL);
+}
+
+
+/* set the cap as ASP_SET_LIMIT does */
+static long asp_test_set_limit(struct asp_mycdev *mycdev, u64 limit)
+{
+	long retval = 0;
+
+	down_write(&mycdev->resizeLock);
+	retval = asp_mycdev_set_limit(mycdev, limit);
+	up_write(&mycdev->resizeLock);
+	return retval;
+}
+
+
+/* the cap is a page multiple not below the size, lseek and creation do not go beyond it */
+static void asp_mycdev_test_limit(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	long saved = max_size_in_bytes;
+	int retval = 0;
+
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->maxSize, (size_t) 0);
+	KUNIT_EXPECT_EQ(test, asp_test_set_limit(ctx->mycdev, 4 * PAGE_SIZE + 1), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, asp_test_set_limit(ctx->mycdev, ASP_TEST_SIZE - PAGE_SIZE), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, asp_test_set_limit(ctx->mycdev, 4 * PAGE_SIZE), 0L);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->maxSize, (size_t) 4 * PAGE_SIZE);
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 4 * PAGE_SIZE, SEEK_SET), (loff_t) 4 * PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 1, SEEK_END), (loff_t) -EFBIG);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->ramdiskSize, (size_t) 4 * PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 4 * PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_set_limit(ctx->mycdev, 2 * PAGE_SIZE), (long) -EINVAL);
+
+	/* 0 lifts the cap */
+	KUNIT_EXPECT_EQ(test, asp_test_set_limit(ctx->mycdev, 0), 0L);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 8 * PAGE_SIZE, SEEK_SET), (loff_t) 8 * PAGE_SIZE);
+
+	/* ASP_CTL_CREATE of a device larger than max_size_in_bytes */
+	max_size_in_bytes = PAGE_SIZE;
+	mutex_lock(&asp_mycdev_devices_lock);
+	retval = asp_mycdev_create(-1, 2 * PAGE_SIZE, 0, NULL);
+	mutex_unlock(&asp_mycdev_devices_lock);
+	max_size_in_bytes = saved;
+	KUNIT_EXPECT_EQ(test, retval, -EFBIG);
+}
+
+
+/* the ASP_MODE_CACHE shrinker drops idle pages and keeps the shared ones */
+static void asp_mycdev_test_cache_shrink(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	struct shrink_control sc = { .gfp_mask = GFP_KERNEL, .nr_to_scan = 128 };
+	u64 reclaimed = 0;
+	int retval = 0, cpu = 0, pass = 0;
+	u8 buf[32];
+
+	memset(buf, 0x33, sizeof(buf));
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), true), (ssize_t) sizeof(buf));
+	ctx->filp->f_pos = PAGE_SIZE;
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), true), (ssize_t) sizeof(buf));
+
+	/* a snapshot shares both pages, a write copies page 0 back out of it */
+	mutex_lock(&asp_mycdev_devices_lock);
+	retval = asp_mycdev_create(-1, ASP_TEST_SIZE, 0, ctx->mycdev);
+	mutex_unlock(&asp_mycdev_devices_lock);
+	KUNIT_ASSERT_GE(test, retval, 0);
+	ctx->filp->f_pos = 0;
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), true), (ssize_t) sizeof(buf));
+	KUNIT_ASSERT_EQ(test, asp_test_set_mode(ctx->mycdev, ASP_MODE_CACHE), 0L);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_shrink_count(&asp_mycdev_shrinker, &sc), 2UL);
+
+	/* the first pass may only age page 0, the second drops it */
+	for(pass = 0; pass < 2; pass++)
+		asp_mycdev_shrink_scan(&asp_mycdev_shrinker, &sc);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 1UL);
+	down_read(&ctx->mycdev->resizeLock);
+	KUNIT_EXPECT_PTR_EQ(test, xa_load(asp_mycdev_pages(ctx->mycdev), 0), NULL);
+	KUNIT_EXPECT_PTR_NE(test, xa_load(asp_mycdev_pages(ctx->mycdev), 1), NULL);
+	up_read(&ctx->mycdev->resizeLock);
+	for_each_possible_cpu(cpu)
+		reclaimed += per_cpu_ptr(ctx->mycdev->stats, cpu)->reclaimedPages;
+	KUNIT_EXPECT_EQ(test, reclaimed, 1ULL);
+
+	/* the dropped page reads as zeros, the shared one kept its data */
+	ctx->filp->f_pos = 0;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) sizeof(buf));
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, sizeof(buf), 0));
+	ctx->filp->f_pos = PAGE_SIZE;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) sizeof(buf));
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, sizeof(buf), 0x33));
+}
+
+
+/* SEEK_DATA and SEEK_HOLE find written pages, the end counts as a hole */
+static void asp_mycdev_test_lseek_data(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 byte = 1;
+
+	ctx->filp->f_pos = PAGE_SIZE + 1;
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, &byte, 1, true), (ssize_t) 1);
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_DATA), (loff_t) PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_HOLE), (loff_t) 0);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, PAGE_SIZE, SEEK_HOLE), (loff_t) ASP_TEST_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, ASP_TEST_SIZE, SEEK_DATA), (loff_t) -ENXIO);
+}
+
+
+/* SEEK_HOLE steps over full leaf nodes and still stops at the first hole */
+static void asp_mycdev_test_lseek_hole_run(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	size_t len = (2 * XA_CHUNK_SIZE + 5) * PAGE_SIZE;
+	u8 *in = kunit_kmalloc(test, len, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, in);
+	memset(in, 0x5a, len);
+
+	KUNIT_ASSERT_GT(test, asp_mycdev_lseek(ctx->filp, 3 * XA_CHUNK_SIZE * PAGE_SIZE, SEEK_SET), (loff_t) 0);
+	ctx->filp->f_pos = 0;
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, in, len, true), (ssize_t) len);
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_HOLE), (loff_t) len);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 3 * PAGE_SIZE + 7, SEEK_HOLE), (loff_t) len);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, len, SEEK_HOLE), (loff_t) len);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, len, SEEK_DATA), (loff_t) -ENXIO);
+}
+
+
+/* transfers over several stripe units are served in slices and stay intact */
+static void asp_mycdev_test_large_transfer(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	size_t len = 4 * ASP_IO_SLICE + 123, i = 0;
+	u8 *in = kunit_kmalloc(test, len, GFP_KERNEL);
+	u8 *out = kunit_kzalloc(test, len, GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, in);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, out);
+	for(i = 0; i < len; i++)
+		in[i] = i * 7;
+
+	KUNIT_ASSERT_GT(test, asp_mycdev_lseek(ctx->filp, 1000 + len, SEEK_SET), (loff_t) 0);
+	ctx->filp->f_pos = 1000;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, in, len, true), (ssize_t) len);
+	ctx->filp->f_pos = 1000;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, out, len, false), (ssize_t) len);
+	KUNIT_EXPECT_EQ(test, memcmp(in, out, len), 0);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 1000 + len);
+}
+
+
+/* clearing zeroes the device and rewinds, ASP_CLEAR_SHRINK also restores the size */
+static void asp_mycdev_test_ioctl_clear(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 buf[32];
+
+	memset(buf, 0x77, sizeof(buf));
+	KUNIT_ASSERT_GT(test, asp_mycdev_lseek(ctx->filp, 4 * PAGE_SIZE, SEEK_SET), (loff_t) 0);
+	ctx->filp->f_pos = PAGE_SIZE;
+	KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), true), (ssize_t) sizeof(buf));
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_CLEAR_BUF, 0), 1L);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 0);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->ramdiskSize, (size_t) 4 * PAGE_SIZE);
+	KUNIT_EXPECT_EQ(test, asp_test_nr_pages(ctx->mycdev), 0UL);
+	ctx->filp->f_pos = PAGE_SIZE;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) sizeof(buf));
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, sizeof(buf), 0));
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_CLEAR_SHRINK, 0), 1L);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->ramdiskSize, (size_t) ASP_TEST_SIZE);
+}
+
+
+/* unknown commands and modes are refused */
+static void asp_mycdev_test_ioctl_invalid(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, _IO(ASP_MYCDEV_MAGIC + 1, 0), 0), (long) -ENOTTY);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, _IO(ASP_MYCDEV_MAGIC, ASP_IOCTL_MAXNR + 1), 0),\
+		(long) -ENOTTY);
+
+	KUNIT_EXPECT_EQ(test, asp_test_set_mode(ctx->mycdev, ~ASP_MODE_MASK), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, asp_test_set_mode(ctx->mycdev, ASP_MODE_FIFO | ASP_MODE_RING), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, ctx->mycdev->mode, 0U);
+}
+
+
+/* in ASP_MODE_APPEND writes go to the tail of the log and reads stop at its end */
+static void asp_mycdev_test_append(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 *big = kunit_kzalloc(test, ASP_TEST_SIZE, GFP_KERNEL);
+	u8 buf[150];
+
+	KUNIT_ASSERT_EQ(test, asp_test_set_mode(ctx->mycdev, ASP_MODE_APPEND), 0L);
+	memset(buf, 0x11, 100);
+	ctx->filp->f_pos = PAGE_SIZE;		/* ignored */
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, 100, true), (ssize_t) 100);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 100);
+	memset(buf, 0x22, 50);
+	ctx->filp->f_pos = 0;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, 50, true), (ssize_t) 50);
+	KUNIT_EXPECT_EQ(test, ctx->filp->f_pos, (loff_t) 150);
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_END), (loff_t) 150);
+	ctx->filp->f_pos = 0;
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) 150);
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf, 100, 0x11));
+	KUNIT_EXPECT_TRUE(test, asp_test_is_filled(buf + 100, 50, 0x22));
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, buf, sizeof(buf), false), (ssize_t) 0);
+
+	/* a record which does not fit is refused as a whole */
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, big);
+	KUNIT_EXPECT_EQ(test, asp_test_io(ctx->filp, big, ASP_TEST_SIZE, true), (ssize_t) -ENOMEM);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->mycdev->log.tail), 150LL);
+
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_CLEAR_BUF, 0), 1L);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_lseek(ctx->filp, 0, SEEK_END), (loff_t) 0);
+}
+
+
+/* a record copied before the ones ahead of it is published once they are */
+static void asp_mycdev_test_append_order(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+	struct asp_mycdev_log_done *second = kzalloc(sizeof(*second), GFP_KERNEL);
+	struct asp_mycdev_log_done *third = kzalloc(sizeof(*third), GFP_KERNEL);
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, second);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, third);
+	KUNIT_ASSERT_EQ(test, asp_test_set_mode(ctx->mycdev, ASP_MODE_APPEND), 0L);
+
+	/* [100, 150) and [150, 200) complete while [0, 100) is still being copied */
+	KUNIT_EXPECT_TRUE(test, asp_mycdev_log_commit(ctx->mycdev, 150, 200, third));
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->mycdev->log.committed), 0LL);
+	KUNIT_EXPECT_TRUE(test, asp_mycdev_log_commit(ctx->mycdev, 100, 150, second));
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->mycdev->log.committed), 0LL);
+
+	/* completing the lowest one publishes all three, and frees the queued entries */
+	KUNIT_EXPECT_FALSE(test, asp_mycdev_log_commit(ctx->mycdev, 0, 100, NULL));
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->mycdev->log.committed), 200LL);
+	KUNIT_EXPECT_TRUE(test, list_empty(&ctx->mycdev->log.done));
+}
+
+
+/* the ioctls which address the device by offset are refused on a log */
+static void asp_mycdev_test_append_reject(struct kunit *test)
+{
+	struct asp_mycdev_test *ctx = test->priv;
+
+	KUNIT_ASSERT_EQ(test, asp_test_set_mode(ctx->mycdev, ASP_MODE_APPEND), 0L);
+	/* refused before the argument is looked at */
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_BATCH, 0), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_ATOMIC, 0), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, asp_mycdev_ioctl(ctx->filp, ASP_COPY_RANGE, 0), (long) -EINVAL);
+	KUNIT_EXPECT_EQ(test, atomic64_read(&ctx->mycdev->log.tail), 0LL);
+}
+
+
+/* microbenchmarks of the data path, without the syscall around it */
+struct asp_test_bench
+{
+	const char *name;
+	size_t block;
+	bool write;
+	u32 mode;
+};
+
+static const struct asp_test_bench asp_test_benches[] = {
+	{ "read 64", 64, false, 0 },
+	{ "read 4096", 4096, false, 0 },
+	{ "read 65536", 65536, false, 0 },
+	{ "lockless read 64", 64, false, ASP_MODE_LOCKLESS_READ },
+	{ "lockless read 4096", 4096, false, ASP_MODE_LOCKLESS_READ },
+	{ "write 64", 64, true, 0 },
+	{ "write 4096", 4096, true, 0 },
+	{ "write 65536", 65536, true, 0 },
+};
+
+static void asp_test_bench_desc(const struct asp_test_bench *bench, char *desc)
+{
+	strscpy(desc, bench->name, KUNIT_PARAM_DESC_SIZE);
+}
+
+KUNIT_ARRAY_PARAM(asp_test_bench, asp_test_benches, asp_test_bench_desc);
+
+/* the device is populated first, so reads copy pages and writes allocate nothing */
+static void asp_mycdev_test_bench(struct kunit *test)
+{
+	const struct asp_test_bench *bench = test->param_value;
+	struct asp_mycdev_test *ctx = test->priv;
+	u8 *buf = kunit_kzalloc(test, ASP_IO_SLICE, GFP_KERNEL);
+	unsigned long i = 0, errors = 0;
+	loff_t pos = 0;
+	u64 start = 0, ns = 0;
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, buf);
+	KUNIT_ASSERT_EQ(test, asp_test_set_mode(ctx->mycdev, bench->mode), 0L);
+	KUNIT_ASSERT_GT(test, asp_mycdev_lseek(ctx->filp, ASP_TEST_BENCH_SPAN, SEEK_SET), (loff_t) 0);
+	for(pos = 0; pos < ASP_TEST_BENCH_SPAN; pos += ASP_IO_SLICE) {
+		ctx->filp->f_pos = pos;
+		KUNIT_ASSERT_EQ(test, asp_test_io(ctx->filp, buf, ASP_IO_SLICE, true), (ssize_t) ASP_IO_SLICE);
+	}
+
+	start = ktime_get_ns();
+	for(i = 0; i < ASP_TEST_BENCH_OPS; i++) {
+		ctx->filp->f_pos = (i * bench->block) % ASP_TEST_BENCH_SPAN;
+		if(asp_test_io(ctx->filp, buf, bench->block, bench->write) != (ssize_t) bench->block)
+			errors++;
+	}
+	ns = ktime_get_ns() - start;
+
+	KUNIT_EXPECT_EQ(test, errors, 0UL);
+	kunit_info(test, "%s: %llu ns/op, %llu MB/s\n", bench->name, div_u64(ns, ASP_TEST_BENCH_OPS),\
+		div64_u64((u64) ASP_TEST_BENCH_OPS * bench->block * 1000, ns ?: 1));
+}
+
+
+static struct kunit_case asp_mycdev_test_cases[] = {
+	KUNIT_CASE(asp_mycdev_test_read_fresh),
+	KUNIT_CASE(asp_mycdev_test_page_boundary),
+	KUNIT_CASE(asp_mycdev_test_read_past_end),
+	KUNIT_CASE(asp_mycdev_test_write_past_end),
+	KUNIT_CASE(asp_mycdev_test_lseek_grow),
+	KUNIT_CASE(asp_mycdev_test_limit),
+	KUNIT_CASE(asp_mycdev_test_cache_shrink),
+	KUNIT_CASE(asp_mycdev_test_lseek_data),
+	KUNIT_CASE(asp_mycdev_test_lseek_hole_run),
+	KUNIT_CASE(asp_mycdev_test_large_transfer),
+	KUNIT_CASE(asp_mycdev_test_ioctl_clear),
+	KUNIT_CASE(asp_mycdev_test_ioctl_invalid),
+	KUNIT_CASE(asp_mycdev_test_append),
+	KUNIT_CASE(asp_mycdev_test_append_order),
+	KUNIT_CASE(asp_mycdev_test_append_reject),
+	KUNIT_CASE_PARAM(asp_mycdev_test_bench, asp_test_bench_gen_params),
+	{}
+};
+
+static struct kunit_suite asp_mycdev_test_suite = {
+	.name = "asp_mycdev",
+	.init = asp_mycdev_test_init,
+	.exit = asp_mycdev_test_exit,
+	.test_cases = asp_mycdev_test_cases,
+};
+kunit_test_suite(asp_mycdev_test_suite);
@@ -0,0 +1,174 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T11:02:17-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: asp_mycdev_trace.h
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T11:02:17-04:00
+ * @License: MIT
+ */
+
+
+
+/* Tracepoints of the driver, see /sys/kernel/tracing/events/asp_mycdev/.
+They cost a patched-out branch while disabled, perf and bpftrace attach to
+them by name, e.g. bpftrace -e 'tracepoint:asp_mycdev:asp_mycdev_read { ... }' */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM asp_mycdev
+
+#if !defined(__ASP_MYCDEV_TRACE__) || defined(TRACE_HEADER_MULTI_READ)
+#define __ASP_MYCDEV_TRACE__
+
+#include <linux/tracepoint.h>
+
+/* open and release of a device node */
+DECLARE_EVENT_CLASS(asp_mycdev_file,
+
+	TP_PROTO(int devID, dev_t devt),
+
+	TP_ARGS(devID, devt),
+
+	TP_STRUCT__entry(
+		__field(int, devID)
+		__field(dev_t, devt)
+	),
+
+	TP_fast_assign(
+		__entry->devID = devID;
+		__entry->devt = devt;
+	),
+
+	TP_printk("mycdev%d major=%u minor=%u", __entry->devID,
+		MAJOR(__entry->devt), MINOR(__entry->devt))
+);
+
+DEFINE_EVENT(asp_mycdev_file, asp_mycdev_open,
+	TP_PROTO(int devID, dev_t devt),
+	TP_ARGS(devID, devt)
+);
+
+DEFINE_EVENT(asp_mycdev_file, asp_mycdev_release,
+	TP_PROTO(int devID, dev_t devt),
+	TP_ARGS(devID, devt)
+);
+
+/* completed read or write, ret is the byte count or the error */
+DECLARE_EVENT_CLASS(asp_mycdev_rw,
+
+	TP_PROTO(int devID, loff_t pos, size_t count, ssize_t ret),
+
+	TP_ARGS(devID, pos, count, ret),
+
+	TP_STRUCT__entry(
+		__field(int, devID)
+		__field(loff_t, pos)
+		__field(size_t, count)
+		__field(ssize_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->devID = devID;
+		__entry->pos = pos;
+		__entry->count = count;
+		__entry->ret = ret;
+	),
+
+	TP_printk("mycdev%d pos=%lld count=%zu ret=%zd", __entry->devID,
+		__entry->pos, __entry->count, __entry->ret)
+);
+
+DEFINE_EVENT(asp_mycdev_rw, asp_mycdev_read,
+	TP_PROTO(int devID, loff_t pos, size_t count, ssize_t ret),
+	TP_ARGS(devID, pos, count, ret)
+);
+
+DEFINE_EVENT(asp_mycdev_rw, asp_mycdev_write,
+	TP_PROTO(int devID, loff_t pos, size_t count, ssize_t ret),
+	TP_ARGS(devID, pos, count, ret)
+);
+
+/* lseek, ret is the new position or the error */
+TRACE_EVENT(asp_mycdev_seek,
+
+	TP_PROTO(int devID, loff_t oldPos, loff_t offset, int whence, loff_t ret),
+
+	TP_ARGS(devID, oldPos, offset, whence, ret),
+
+	TP_STRUCT__entry(
+		__field(int, devID)
+		__field(loff_t, oldPos)
+		__field(loff_t, offset)
+		__field(int, whence)
+		__field(loff_t, ret)
+	),
+
+	TP_fast_assign(
+		__entry->devID = devID;
+		__entry->oldPos = oldPos;
+		__entry->offset = offset;
+		__entry->whence = whence;
+		__entry->ret = ret;
+	),
+
+	TP_printk("mycdev%d old_pos=%lld offset=%lld whence=%s ret=%lld", __entry->devID,
+		__entry->oldPos, __entry->offset,
+		__print_symbolic(__entry->whence,
+			{ SEEK_SET, "SEEK_SET" }, { SEEK_CUR, "SEEK_CUR" }, { SEEK_END, "SEEK_END" },
+			{ SEEK_DATA, "SEEK_DATA" }, { SEEK_HOLE, "SEEK_HOLE" }),
+		__entry->ret)
+);
+
+/* growth of the ramdisk, ret is 0 or the error */
+TRACE_EVENT(asp_mycdev_resize,
+
+	TP_PROTO(int devID, size_t oldSize, size_t newSize, int ret),
+
+	TP_ARGS(devID, oldSize, newSize, ret),
+
+	TP_STRUCT__entry(
+		__field(int, devID)
+		__field(size_t, oldSize)
+		__field(size_t, newSize)
+		__field(int, ret)
+	),
+
+	TP_fast_assign(
+		__entry->devID = devID;
+		__entry->oldSize = oldSize;
+		__entry->newSize = newSize;
+		__entry->ret = ret;
+	),
+
+	TP_printk("mycdev%d old_size=%zu new_size=%zu ret=%d", __entry->devID,
+		__entry->oldSize, __entry->newSize, __entry->ret)
+);
+
+/* ASP_CLEAR_BUF */
+TRACE_EVENT(asp_mycdev_clear,
+
+	TP_PROTO(int devID, size_t size),
+
+	TP_ARGS(devID, size),
+
+	TP_STRUCT__entry(
+		__field(int, devID)
+		__field(size_t, size)
+	),
+
+	TP_fast_assign(
+		__entry->devID = devID;
+		__entry->size = size;
+	),
+
+	TP_printk("mycdev%d size=%zu", __entry->devID, __entry->size)
+);
+
+#endif /* __ASP_MYCDEV_TRACE__ */
+
+/* This part must be outside protection */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE asp_mycdev_trace
+#include <trace/define_trace.h>
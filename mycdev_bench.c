@@ -0,0 +1,346 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T17:05:31-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: mycdev_bench.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T17:05:31-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Benchmark harness: runs <threads> workers against one device for <seconds>,
+   each doing block sized reads and writes in the given mix, sequentially or at
+   random block aligned offsets, through read/write, pread/pwrite, preadv/pwritev
+   or a shared mapping. Prints one JSON object per run with the throughput and
+   the p50/p99/p999 latency, with -S once for every power of two threads upto
+   <threads> so scaling can be tracked over time.
+ @*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#include "asp_mycdev.h"
+
+enum method { M_READ, M_PREAD, M_READV, M_MMAP };
+static const char *methodNames[] = { "read", "pread", "readv", "mmap" };
+
+/* log-linear latency histogram: 16 linear sub buckets per power of two, ~6% error */
+#define SUB_BITS  4
+#define SUB_COUNT  (1 << SUB_BITS)
+#define HIST_BUCKETS  ((64 - SUB_BITS + 1) * SUB_COUNT)
+
+/* segments of a block for preadv/pwritev */
+#define IOV_SEGMENTS  4
+
+struct worker
+{
+	pthread_t tid;
+	int id;
+	int fd;
+	uint64_t seed;
+	uint64_t reads, writes, errors;
+	uint64_t maxNs;
+	uint64_t hist[HIST_BUCKETS];
+};
+
+static char *nodename = NULL;
+static enum method method = M_PREAD;
+static int randomPattern = 0;
+static int writePct = 0;
+static size_t blockSize = 4096;
+static off_t devSize = 0;
+static unsigned char *map = NULL;
+static int nthreads = 0;
+static volatile int stop = 0;
+
+static unsigned int hist_index(uint64_t ns)
+{
+	unsigned int msb;
+
+	if(ns < SUB_COUNT)
+		return ns;
+	msb = 63 - __builtin_clzll(ns);
+	return (msb - SUB_BITS + 1) * SUB_COUNT + ((ns >> (msb - SUB_BITS)) & (SUB_COUNT - 1));
+}
+
+/* lower bound of a bucket, what percentiles report */
+static uint64_t hist_value(unsigned int index)
+{
+	unsigned int group = index / SUB_COUNT, sub = index % SUB_COUNT;
+
+	if(group == 0)
+		return sub;
+	return (uint64_t)(SUB_COUNT + sub) << (group - 1);
+}
+
+static uint64_t xorshift(uint64_t *state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	return *state = x;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* one block through the selected method, returns 0 on success */
+static int do_op(struct worker *w, char *buf, off_t offset, int isWrite)
+{
+	struct iovec iov[IOV_SEGMENTS];
+	size_t seg = blockSize / IOV_SEGMENTS;
+	ssize_t rc = -1;
+	int i;
+
+	switch(method)
+	{
+		case M_READ:
+			if(lseek(w->fd, offset, SEEK_SET) != offset)
+				return -1;
+			rc = isWrite? write(w->fd, buf, blockSize) : read(w->fd, buf, blockSize);
+			break;
+
+		case M_PREAD:
+			rc = isWrite? pwrite(w->fd, buf, blockSize, offset) : pread(w->fd, buf, blockSize, offset);
+			break;
+
+		case M_READV:
+			for(i = 0; i < IOV_SEGMENTS; i++) {
+				iov[i].iov_base = buf + i * seg;
+				iov[i].iov_len = (i == IOV_SEGMENTS - 1)? blockSize - i * seg : seg;
+			}
+			rc = isWrite? pwritev(w->fd, iov, IOV_SEGMENTS, offset) : preadv(w->fd, iov, IOV_SEGMENTS, offset);
+			break;
+
+		case M_MMAP:
+			if(isWrite)
+				memcpy(map + offset, buf, blockSize);
+			else
+				memcpy(buf, map + offset, blockSize);
+			rc = blockSize;
+			break;
+	}
+	return rc == (ssize_t) blockSize? 0 : -1;
+}
+
+static void *worker(void *arg)
+{
+	struct worker *w = arg;
+	off_t blocks = devSize / blockSize;
+	off_t block = (blocks / nthreads) * w->id;	/* sequential workers start spread out */
+	char *buf = malloc(blockSize);
+
+	if(buf == NULL) {
+		w->errors++;
+		return NULL;
+	}
+	memset(buf, 0x5a + w->id, blockSize);
+	while(!stop) {
+		int isWrite = (int)(xorshift(&w->seed) % 100) < writePct;
+		uint64_t start, ns;
+
+		if(randomPattern)
+			block = xorshift(&w->seed) % blocks;
+		else if(++block >= blocks)
+			block = 0;
+
+		start = now_ns();
+		if(do_op(w, buf, block * blockSize, isWrite)) {
+			w->errors++;
+			continue;
+		}
+		ns = now_ns() - start;
+
+		w->hist[hist_index(ns)]++;
+		if(ns > w->maxNs)
+			w->maxNs = ns;
+		if(isWrite)
+			w->writes++;
+		else
+			w->reads++;
+	}
+	free(buf);
+	return NULL;
+}
+
+static uint64_t percentile(const uint64_t *hist, uint64_t total, double p)
+{
+	uint64_t rank = (uint64_t)(total * p), seen = 0;
+	unsigned int i;
+
+	for(i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if(seen > rank)
+			return hist_value(i);
+	}
+	return 0;
+}
+
+/* runs threads workers for seconds and prints the result */
+static int run(int threads, int seconds)
+{
+	struct worker *workers = calloc(threads, sizeof(*workers));
+	static uint64_t hist[HIST_BUCKETS];
+	uint64_t reads = 0, writes = 0, errors = 0, maxNs = 0, ops;
+	double elapsed;
+	uint64_t start;
+	int i, j;
+
+	if(workers == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	nthreads = threads;
+	stop = 0;
+	memset(hist, 0, sizeof(hist));
+	for(i = 0; i < threads; i++) {
+		workers[i].id = i;
+		workers[i].seed = 0x9e3779b97f4a7c15ULL * (i + 1);
+		/* read/write move the file position, every worker needs its own file */
+		workers[i].fd = open(nodename, O_RDWR);
+		if(workers[i].fd < 0) {
+			perror("open");
+			while(i--)
+				close(workers[i].fd);
+			free(workers);
+			return -1;
+		}
+	}
+
+	start = now_ns();
+	for(i = 0; i < threads; i++)
+		pthread_create(&workers[i].tid, NULL, worker, &workers[i]);
+	sleep(seconds);
+	stop = 1;
+	for(i = 0; i < threads; i++)
+		pthread_join(workers[i].tid, NULL);
+	elapsed = (now_ns() - start) / 1e9;
+
+	for(i = 0; i < threads; i++) {
+		reads += workers[i].reads;
+		writes += workers[i].writes;
+		errors += workers[i].errors;
+		if(workers[i].maxNs > maxNs)
+			maxNs = workers[i].maxNs;
+		for(j = 0; j < HIST_BUCKETS; j++)
+			hist[j] += workers[i].hist[j];
+		close(workers[i].fd);
+	}
+	ops = reads + writes;
+
+	printf("{\"device\":\"%s\",\"method\":\"%s\",\"pattern\":\"%s\",\"threads\":%d,"
+	       "\"block_size\":%zu,\"write_pct\":%d,\"seconds\":%.3f,"
+	       "\"reads\":%llu,\"writes\":%llu,\"errors\":%llu,"
+	       "\"ops_per_sec\":%.0f,\"mb_per_sec\":%.1f,"
+	       "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+	       nodename, methodNames[method], randomPattern? "random" : "sequential", threads,
+	       blockSize, writePct, elapsed,
+	       (unsigned long long) reads, (unsigned long long) writes, (unsigned long long) errors,
+	       ops / elapsed, ops * blockSize / elapsed / (1 << 20),
+	       (unsigned long long) percentile(hist, ops, 0.50),
+	       (unsigned long long) percentile(hist, ops, 0.99),
+	       (unsigned long long) percentile(hist, ops, 0.999),
+	       (unsigned long long) maxNs);
+	fflush(stdout);
+	free(workers);
+	return 0;
+}
+
+static void usage(char *prog)
+{
+	printf("USAGE:\n\t %s [-t threads] [-b block-size] [-w write-percent] [-p seq|rand]\n"
+	       "\t\t[-m read|pread|readv|mmap] [-d seconds] [-S] <device-node-name>\n"
+	       "\t -S runs 1, 2, 4 ... <threads> workers, one JSON line each\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int threads = 1, seconds = 5, sweep = 0, opt, i;
+	int fd;
+
+	while((opt = getopt(argc, argv, "t:b:w:p:m:d:S")) != -1) {
+		switch(opt)
+		{
+			case 't': threads = atoi(optarg); break;
+			case 'b': blockSize = strtoul(optarg, NULL, 0); break;
+			case 'w': writePct = atoi(optarg); break;
+			case 'd': seconds = atoi(optarg); break;
+			case 'S': sweep = 1; break;
+			case 'p':
+				if(strcmp(optarg, "seq") && strcmp(optarg, "rand")) {
+					usage(argv[0]);
+					return 1;
+				}
+				randomPattern = !strcmp(optarg, "rand");
+				break;
+			case 'm':
+				for(i = 0; i <= M_MMAP; i++)
+					if(!strcmp(optarg, methodNames[i]))
+						break;
+				if(i > M_MMAP) {
+					usage(argv[0]);
+					return 1;
+				}
+				method = i;
+				break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1 || threads < 1 || seconds < 1 || blockSize < IOV_SEGMENTS ||
+	   writePct < 0 || writePct > 100) {
+		usage(argv[0]);
+		return 1;
+	}
+	nodename = argv[optind];
+
+	fd = open(nodename, O_RDWR);
+	if(fd < 0) {
+		perror("open");
+		return 1;
+	}
+	devSize = lseek(fd, 0, SEEK_END);
+	if(devSize < (off_t) blockSize) {
+		fprintf(stderr, "device is smaller than one block (%ld bytes)\n", (long) devSize);
+		return 1;
+	}
+	if(method == M_MMAP) {
+		map = mmap(NULL, devSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if(map == MAP_FAILED) {
+			perror("mmap");
+			return 1;
+		}
+	}
+
+	/* doubling, the last step runs the requested count even if it is no power of two */
+	for(i = sweep? 1 : threads; ; i = (i * 2 < threads)? i * 2 : threads) {
+		if(run(i, seconds))
+			return 1;
+		if(i == threads)
+			break;
+	}
+
+	if(map)
+		munmap(map, devSize);
+	close(fd);
+	exit(0);
+}
@@ -0,0 +1,163 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T15:02:48-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: mycdev_ctl.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T15:02:48-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Front end of the control device: creates, destroys and lists devices
+   through the ASP_CTL_* ioctls of /dev/mycdev-control, takes snapshots of a
+   device with ASP_SNAPSHOT, copies one device into another with
+   ASP_COPY_RANGE and shows or sets the size cap with ASP_GET/SET_LIMIT.
+ @*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+#include "asp_mycdev.h"
+
+static void usage(const char *prog)
+{
+	printf("USAGE:\n\t %s create [size-in-bytes] [mode] [id]\n", prog);
+	printf("\t %s destroy <id>\n", prog);
+	printf("\t %s list\n", prog);
+	printf("\t %s snapshot <device-node-name> [id]\n", prog);
+	printf("\t %s copy <source-node-name> <destination-node-name> [share]\n", prog);
+	printf("\t %s limit <device-node-name> [size-in-bytes, 0 for none]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	int fd;
+
+	if(argc < 2) {
+		usage(argv[0]);
+		return 0;
+	}
+
+	fd = open(ASP_CONTROL_NODE, O_RDWR);
+	if(fd < 0) {
+		perror("open "ASP_CONTROL_NODE);
+		return 1;
+	}
+
+	if(strcmp(argv[1], "create") == 0) {
+		struct asp_mycdev_create req = { .id = -1 };
+
+		if(argc > 2)
+			req.size = strtoull(argv[2], NULL, 0);
+		if(argc > 3)
+			req.mode = strtoul(argv[3], NULL, 0);
+		if(argc > 4)
+			req.id = atoi(argv[4]);
+		if(ioctl(fd, ASP_CTL_CREATE, &req) < 0) {
+			perror("ASP_CTL_CREATE");
+			return 1;
+		}
+		printf("created /dev/%s%d\n", "mycdev", req.id);
+	}
+	else if(strcmp(argv[1], "destroy") == 0 && argc == 3) {
+		__u32 id = atoi(argv[2]);
+
+		if(ioctl(fd, ASP_CTL_DESTROY, &id) < 0) {
+			perror("ASP_CTL_DESTROY");
+			return 1;
+		}
+		printf("destroyed /dev/%s%u\n", "mycdev", id);
+	}
+	else if(strcmp(argv[1], "list") == 0) {
+		struct asp_mycdev_list req = { 0 };
+		__u32 *ids = NULL, capacity = 0, i;
+
+		/* grow the array until it holds all devices, they may come and go meanwhile */
+		for(;;) {
+			req.count = capacity;
+			req.ids = (uintptr_t) ids;
+			if(ioctl(fd, ASP_CTL_LIST, &req) < 0) {
+				perror("ASP_CTL_LIST");
+				return 1;
+			}
+			if(req.count <= capacity)
+				break;
+			capacity = req.count;
+			free(ids);
+			ids = calloc(capacity, sizeof(*ids));
+		}
+		for(i = 0; i < req.count; i++)
+			printf("/dev/%s%u\n", "mycdev", ids[i]);
+		free(ids);
+	}
+	else if(strcmp(argv[1], "snapshot") == 0 && (argc == 3 || argc == 4)) {
+		__s32 id = (argc == 4)? atoi(argv[3]) : -1;
+		int dev = open(argv[2], O_RDWR);
+
+		if(dev < 0) {
+			perror("open");
+			return 1;
+		}
+		if(ioctl(dev, ASP_SNAPSHOT, &id) < 0) {
+			perror("ASP_SNAPSHOT");
+			return 1;
+		}
+		printf("snapshot of %s is /dev/%s%d\n", argv[2], "mycdev", id);
+		close(dev);
+	}
+	else if(strcmp(argv[1], "copy") == 0 && (argc == 4 || (argc == 5 && strcmp(argv[4], "share") == 0))) {
+		struct asp_mycdev_copy_range req = { .flags = (argc == 5)? ASP_COPY_SHARE : 0 };
+		int src = open(argv[2], O_RDONLY), dst = open(argv[3], O_RDWR);
+
+		if(src < 0 || dst < 0) {
+			perror("open");
+			return 1;
+		}
+		req.src_fd = src;
+		req.len = lseek(src, 0, SEEK_END);
+		if(ioctl(dst, ASP_COPY_RANGE, &req) < 0) {
+			perror("ASP_COPY_RANGE");
+			return 1;
+		}
+		printf("copied %llu bytes from %s to %s\n", (unsigned long long) req.copied, argv[2], argv[3]);
+		close(src);
+		close(dst);
+	}
+	else if(strcmp(argv[1], "limit") == 0 && (argc == 3 || argc == 4)) {
+		__u64 limit = 0;
+		int dev = open(argv[2], O_RDWR);
+
+		if(dev < 0) {
+			perror("open");
+			return 1;
+		}
+		if(argc == 4) {
+			limit = strtoull(argv[3], NULL, 0);
+			if(ioctl(dev, ASP_SET_LIMIT, &limit) < 0) {
+				perror("ASP_SET_LIMIT");
+				return 1;
+			}
+		}
+		if(ioctl(dev, ASP_GET_LIMIT, &limit) < 0) {
+			perror("ASP_GET_LIMIT");
+			return 1;
+		}
+		printf("limit of %s: %llu bytes\n", argv[2], (unsigned long long) limit);
+		close(dev);
+	}
+	else {
+		usage(argv[0]);
+		return 1;
+	}
+
+	close(fd);
+	exit(0);
+}
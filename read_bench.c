@@ -0,0 +1,117 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T10:12:41-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: read_bench.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T10:12:41-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Reader scaling benchmark: runs 1, 2, 4 ... <max-threads> concurrent readers
+   against one device and reports the aggregate read rate for each step, with
+   ASP_MODE_LOCKLESS_READ switched on or off.
+ @*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+
+#include "asp_mycdev.h"
+
+static int fd = -1;
+static off_t devSize = 0;
+static size_t blockSize = 512;
+static volatile int stop = 0;
+
+/* every reader preads random blocks until told to stop */
+static void *reader(void *arg)
+{
+	unsigned long *reads = arg;
+	unsigned int seed = (unsigned int)(unsigned long) arg;
+	off_t blocks = devSize / blockSize;
+	char *buf = malloc(blockSize);
+
+	while(!stop) {
+		off_t offset = (rand_r(&seed) % blocks) * blockSize;
+
+		if(pread(fd, buf, blockSize, offset) != (ssize_t) blockSize) {
+			perror("pread");
+			break;
+		}
+		(*reads)++;
+	}
+	free(buf);
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	int maxThreads, seconds, threads, i;
+	__u32 mode;
+	char *nodename;
+	pthread_t *tids;
+	unsigned long *reads;
+
+	if(argc == 5 || argc == 6) {
+		nodename = argv[1];
+		maxThreads = atoi(argv[2]);
+		seconds = atoi(argv[3]);
+		mode = atoi(argv[4])? ASP_MODE_LOCKLESS_READ : 0;
+		if(argc == 6)
+			blockSize = atoi(argv[5]);
+	}
+	else {
+		printf("USAGE:\n\t %s <device-node-name> <max-threads> <seconds> <lockless: 0|1> [block-size]\n", argv[0]);
+		return 0;
+	}
+
+	fd = open(nodename, O_RDWR);
+	if(fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if(ioctl(fd, ASP_SET_MODE, &mode) < 0) {
+		perror("ASP_SET_MODE");
+		return 1;
+	}
+	devSize = lseek(fd, 0, SEEK_END);
+	if(devSize < (off_t) blockSize) {
+		printf("device is smaller than one block (%ld bytes)\n", (long) devSize);
+		return 1;
+	}
+
+	tids = calloc(maxThreads, sizeof(*tids));
+	reads = calloc(maxThreads, sizeof(*reads));
+	printf("device: %s, size: %ld, block size: %zu, lockless: %s\n",
+	       nodename, (long) devSize, blockSize, mode? "yes" : "no");
+
+	for(threads = 1; threads <= maxThreads; threads *= 2) {
+		unsigned long total = 0;
+
+		stop = 0;
+		memset(reads, 0, maxThreads * sizeof(*reads));
+		for(i = 0; i < threads; i++)
+			pthread_create(&tids[i], NULL, reader, &reads[i]);
+		sleep(seconds);
+		stop = 1;
+		for(i = 0; i < threads; i++) {
+			pthread_join(tids[i], NULL);
+			total += reads[i];
+		}
+		printf("threads: %3d, reads/s: %12.0f, MB/s: %10.1f\n", threads,
+		       (double) total / seconds, (double) total * blockSize / seconds / (1 << 20));
+	}
+
+	free(tids);
+	free(reads);
+	close(fd);
+	exit(0);
+}
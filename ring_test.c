@@ -0,0 +1,176 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T13:40:12-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: ring_test.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T13:40:12-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Shared ring test: switches a device to ASP_MODE_RING, maps the header and
+   the data area, streams <megabytes> of a byte pattern from a producer thread
+   to a consumer thread through the ring and checks it on the way out. Sleeps
+   go through eventfd doorbells, the number of kicks is reported at the end.
+ @*/
+
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+
+#include "asp_mycdev.h"
+
+static int fd = -1;
+static int dataFd = -1, spaceFd = -1;
+static struct asp_mycdev_ring *ring = NULL;
+static unsigned char *data = NULL;
+static uint64_t total = 0;
+static unsigned long kicks = 0;
+
+/* sleep until ready() holds, following the protocol of struct asp_mycdev_ring */
+static void ring_wait(int efd, __u32 bit, int (*ready)(void))
+{
+	uint64_t value;
+
+	while(!ready()) {
+		__atomic_fetch_or(&ring->waiting, bit, __ATOMIC_SEQ_CST);
+		if(ready()) {
+			__atomic_fetch_and(&ring->waiting, ~bit, __ATOMIC_SEQ_CST);
+			return;
+		}
+		if(read(efd, &value, sizeof(value)) != sizeof(value))
+			perror("read eventfd");
+	}
+}
+
+/* wake the peer up if it announced that it is going to sleep */
+static void ring_kick(__u32 bit, unsigned long bell)
+{
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if(__atomic_load_n(&ring->waiting, __ATOMIC_RELAXED) & bit) {
+		__atomic_fetch_and(&ring->waiting, ~bit, __ATOMIC_SEQ_CST);
+		if(ioctl(fd, ASP_RING_KICK, bell) < 0)
+			perror("ASP_RING_KICK");
+		__atomic_fetch_add(&kicks, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static int has_data(void)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) != __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+}
+
+static int has_space(void)
+{
+	return __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) < ring->size;
+}
+
+static void *producer(void *arg)
+{
+	uint64_t tail = 0, head, n, i;
+
+	while(tail < total) {
+		ring_wait(spaceFd, ASP_RING_WAIT_SPACE, has_space);
+		head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+		n = ring->size - (tail - head);
+		if(n > total - tail)
+			n = total - tail;
+		for(i = 0; i < n; i++)
+			data[(tail + i) % ring->size] = (unsigned char) (tail + i);
+		tail += n;
+		__atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+		ring_kick(ASP_RING_WAIT_DATA, ASP_RING_KICK_DATA);
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	uint64_t head = 0, tail, i;
+	long *errors = arg;
+
+	while(head < total) {
+		ring_wait(dataFd, ASP_RING_WAIT_DATA, has_data);
+		tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+		for(i = head; i < tail; i++)
+			if(data[i % ring->size] != (unsigned char) i)
+				(*errors)++;
+		head = tail;
+		__atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+		ring_kick(ASP_RING_WAIT_SPACE, ASP_RING_KICK_SPACE);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv)
+{
+	__u32 mode = ASP_MODE_RING;
+	struct asp_mycdev_ring_eventfd fds;
+	pthread_t ptid, ctid;
+	long errors = 0;
+	char *nodename;
+
+	if(argc == 3) {
+		nodename = argv[1];
+		total = strtoull(argv[2], NULL, 0) << 20;
+	}
+	else {
+		printf("USAGE:\n\t %s <device-node-name> <megabytes>\n", argv[0]);
+		return 0;
+	}
+
+	fd = open(nodename, O_RDWR);
+	if(fd < 0) {
+		perror("open");
+		return 1;
+	}
+	if(ioctl(fd, ASP_SET_MODE, &mode) < 0) {
+		perror("ASP_SET_MODE");
+		return 1;
+	}
+	dataFd = eventfd(0, 0);
+	spaceFd = eventfd(0, 0);
+	fds.dataFd = dataFd;
+	fds.spaceFd = spaceFd;
+	if(ioctl(fd, ASP_RING_SET_EVENTFD, &fds) < 0) {
+		perror("ASP_RING_SET_EVENTFD");
+		return 1;
+	}
+
+	ring = mmap(NULL, getpagesize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, ASP_RING_HEADER_OFFSET);
+	if(ring == MAP_FAILED) {
+		perror("mmap header");
+		return 1;
+	}
+	data = mmap(NULL, ring->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(data == MAP_FAILED) {
+		perror("mmap data");
+		return 1;
+	}
+	printf("device: %s, ring size: %llu, streaming %llu bytes\n",
+	       nodename, (unsigned long long) ring->size, (unsigned long long) total);
+
+	pthread_create(&ctid, NULL, consumer, &errors);
+	pthread_create(&ptid, NULL, producer, NULL);
+	pthread_join(ptid, NULL);
+	pthread_join(ctid, NULL);
+
+	printf("%s: %ld corrupted bytes, %lu kicks\n", errors? "FAIL" : "PASS", errors, kicks);
+
+	munmap(data, ring->size);
+	munmap(ring, getpagesize());
+	mode = 0;
+	ioctl(fd, ASP_SET_MODE, &mode);
+	close(fd);
+	exit(errors? 1 : 0);
+}
@@ -0,0 +1,147 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T14:05:27-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: splice_bench.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T14:05:27-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Streaming benchmark: copies the whole device <rounds> times to <output>
+   (a file, /dev/null, ...) with read+write through a user buffer, with
+   sendfile and with splice through a pipe, and reports the rate of each.
+ @*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/sendfile.h>
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* read into a user buffer and write it out, two copies per byte */
+static ssize_t copy_rw(int in, int out, size_t size, size_t chunk)
+{
+	static char *buf = NULL;
+	size_t done = 0;
+	ssize_t n;
+
+	if(buf == NULL)
+		buf = malloc(chunk);
+	while(done < size) {
+		n = pread(in, buf, chunk, done);
+		if(n <= 0)
+			return -1;
+		if(write(out, buf, n) != n)
+			return -1;
+		done += n;
+	}
+	return done;
+}
+
+/* sendfile, the device pages go to the output without a user copy */
+static ssize_t copy_sendfile(int in, int out, size_t size, size_t chunk)
+{
+	off_t offset = 0;
+	ssize_t n;
+
+	while((size_t) offset < size) {
+		n = sendfile(out, in, &offset, chunk);
+		if(n <= 0)
+			return -1;
+	}
+	return offset;
+}
+
+/* splice from the device into a pipe and from the pipe to the output */
+static ssize_t copy_splice(int in, int out, size_t size, size_t chunk)
+{
+	static int pipefd[2] = { -1, -1 };
+	loff_t offset = 0;
+	ssize_t n, m;
+
+	if(pipefd[0] < 0 && pipe(pipefd) < 0)
+		return -1;
+	while((size_t) offset < size) {
+		n = splice(in, &offset, pipefd[1], NULL, chunk, SPLICE_F_MOVE);
+		if(n <= 0)
+			return -1;
+		while(n > 0) {
+			m = splice(pipefd[0], NULL, out, NULL, n, SPLICE_F_MOVE);
+			if(m <= 0)
+				return -1;
+			n -= m;
+		}
+	}
+	return offset;
+}
+
+static void run(const char *name, ssize_t (*copy)(int, int, size_t, size_t),
+		int in, int out, size_t size, size_t chunk, int rounds)
+{
+	double start = now(), elapsed;
+	int i;
+
+	for(i = 0; i < rounds; i++) {
+		lseek(out, 0, SEEK_SET);	/* fails harmlessly on pipes and sockets */
+		if(copy(in, out, size, chunk) != (ssize_t) size) {
+			perror(name);
+			return;
+		}
+	}
+	elapsed = now() - start;
+	printf("%-10s MB/s: %10.1f\n", name, (double) size * rounds / elapsed / (1 << 20));
+}
+
+int main(int argc, char **argv)
+{
+	int in, out, rounds;
+	size_t chunk = 64 * 1024;
+	off_t size;
+
+	if(argc == 4 || argc == 5) {
+		rounds = atoi(argv[3]);
+		if(argc == 5)
+			chunk = atoi(argv[4]);
+	}
+	else {
+		printf("USAGE:\n\t %s <device-node-name> <output> <rounds> [chunk-size]\n", argv[0]);
+		return 0;
+	}
+
+	in = open(argv[1], O_RDONLY);
+	if(in < 0) {
+		perror("open device");
+		return 1;
+	}
+	out = open(argv[2], O_WRONLY | O_CREAT, 0644);
+	if(out < 0) {
+		perror("open output");
+		return 1;
+	}
+	size = lseek(in, 0, SEEK_END);
+	printf("device: %s, size: %ld, output: %s, chunk: %zu, rounds: %d\n",
+	       argv[1], (long) size, argv[2], chunk, rounds);
+
+	run("read+write", copy_rw, in, out, size, chunk, rounds);
+	run("sendfile", copy_sendfile, in, out, size, chunk, rounds);
+	run("splice", copy_splice, in, out, size, chunk, rounds);
+
+	close(in);
+	close(out);
+	exit(0);
+}
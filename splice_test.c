@@ -0,0 +1,105 @@
+/**
+ * @Author: Izhar Shaikh <izhar>
+ * @Date:   2026-10-16T23:40:11-04:00
+ * @Email:  izharits@gmail.com
+ * @Filename: splice_test.c
+ * @Last modified by:   izhar
+ * @Last modified time: 2026-10-16T23:40:11-04:00
+ * @License: MIT
+ */
+
+
+
+/*
+   Checks that splice and sendfile move the data of written device pages:
+   writes a pattern over two pages, splices it into a pipe and reads the pipe,
+   then sendfiles it into a memfd and reads that back. Overwrites the first
+   two pages of the device.
+ @*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#define TEST_LEN  (2 * 4096)
+
+static int check(const char *name, const char *got, ssize_t len, const char *want)
+{
+	if(len != TEST_LEN || memcmp(got, want, TEST_LEN)) {
+		printf("%s: FAILED (%zd bytes, %s)\n", name, len, (len == TEST_LEN)? "wrong data" : "short");
+		return 1;
+	}
+	printf("%s: ok\n", name);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	static char want[TEST_LEN], got[TEST_LEN];
+	int fd, mfd, pipefd[2], i, failed = 0;
+	loff_t offset = 0;
+	off_t soffset = 0;
+	ssize_t n, len = 0;
+
+	if(argc != 2) {
+		printf("USAGE:\n\t %s <device-node-name>\n", argv[0]);
+		return 0;
+	}
+
+	fd = open(argv[1], O_RDWR);
+	if(fd < 0) {
+		perror("open");
+		return 1;
+	}
+	for(i = 0; i < TEST_LEN; i++)
+		want[i] = 'a' + i % 26;
+	if(pwrite(fd, want, TEST_LEN, 0) != TEST_LEN) {
+		perror("pwrite");
+		return 1;
+	}
+
+	/* device -> pipe -> user buffer */
+	if(pipe(pipefd) < 0) {
+		perror("pipe");
+		return 1;
+	}
+	fcntl(pipefd[1], F_SETPIPE_SZ, TEST_LEN);
+	while(len < TEST_LEN) {
+		n = splice(fd, &offset, pipefd[1], NULL, TEST_LEN - len, 0);
+		if(n <= 0)
+			break;
+		if(read(pipefd[0], got + len, n) != n)
+			break;
+		len += n;
+	}
+	failed |= check("splice", got, len, want);
+
+	/* device -> memfd, through the internal pipe of sendfile */
+	memset(got, 0, TEST_LEN);
+	mfd = memfd_create("splice_test", 0);
+	if(mfd < 0) {
+		perror("memfd_create");
+		return 1;
+	}
+	len = 0;
+	while(len < TEST_LEN) {
+		n = sendfile(mfd, fd, &soffset, TEST_LEN - len);
+		if(n <= 0)
+			break;
+		len += n;
+	}
+	if(pread(mfd, got, TEST_LEN, 0) != len)
+		len = -1;
+	failed |= check("sendfile", got, len, want);
+
+	close(mfd);
+	close(pipefd[0]);
+	close(pipefd[1]);
+	close(fd);
+	exit(failed);
+}